@@ -0,0 +1,207 @@
+/** ===========================================================================
+  Arduino.h (host stand-in)
+
+  Minimal in-process replacement of the Arduino core so the led_control
+  sketch can be compiled and run on a Linux host. Only the parts the sketch
+  actually uses are provided.
+
+  Pin inputs are scripted from the host side:
+    host_set_analog(pin, value)     value returned by analogRead(pin)
+    host_set_digital(pin, value)    value returned by digitalRead(pin)
+
+  So is the rest of the environment:
+    host_serial_input(text)         text read from Serial
+    host_skip_delays                delays of the current thread return
+                                    right away, e.g. to run loop() quickly
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <string.h>
+#include <math.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <thread>
+
+using std::abs;
+using std::max;
+using std::min;
+
+#define HIGH 0x1
+#define LOW  0x0
+
+#define INPUT         0x01
+#define OUTPUT        0x03
+#define INPUT_PULLUP  0x05
+
+#ifndef PI
+#define PI 3.1415926535897932384626433832795
+#endif
+
+#define constrain(amt, low, high) \
+  ((amt) < (low) ? (low) : ((amt) > (high) ? (high) : (amt)))
+
+
+/* ========================================================================= */
+/* pins */
+
+#define HOST_PIN_COUNT 40
+
+inline uint16_t host_analog_values[HOST_PIN_COUNT] = {};
+inline uint8_t host_digital_values[HOST_PIN_COUNT] = {};
+
+inline void host_set_analog(uint8_t pin, uint16_t value) {
+  host_analog_values[pin % HOST_PIN_COUNT] = value;
+}
+
+inline void host_set_digital(uint8_t pin, uint8_t value) {
+  host_digital_values[pin % HOST_PIN_COUNT] = value;
+}
+
+inline void pinMode(uint8_t pin, uint8_t mode) {
+  // pulled up inputs idle high, just like the real buttons
+  if (mode == INPUT_PULLUP)
+    host_set_digital(pin, HIGH);
+}
+
+inline int digitalRead(uint8_t pin) {
+  return host_digital_values[pin % HOST_PIN_COUNT];
+}
+
+inline void digitalWrite(uint8_t pin, uint8_t value) {
+  host_set_digital(pin, value);
+}
+
+inline uint16_t analogRead(uint8_t pin) {
+  return host_analog_values[pin % HOST_PIN_COUNT];
+}
+
+
+/* ========================================================================= */
+/* time */
+
+inline std::chrono::steady_clock::time_point host_start_time =
+  std::chrono::steady_clock::now();
+
+inline unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+           std::chrono::steady_clock::now() - host_start_time).count();
+}
+
+inline unsigned long millis() {
+  return micros() / 1000;
+}
+
+inline thread_local bool host_skip_delays = false;
+
+inline void delay(uint32_t ms) {
+  if (!host_skip_delays)
+    std::this_thread::sleep_for(std::chrono::milliseconds(ms));
+}
+
+inline void delayMicroseconds(uint32_t us) {
+  if (!host_skip_delays)
+    std::this_thread::sleep_for(std::chrono::microseconds(us));
+}
+
+
+/* ========================================================================= */
+/* random numbers */
+
+inline uint32_t host_random_state = 1;
+
+inline void randomSeed(unsigned long seed) {
+  if (seed != 0)
+    host_random_state = seed;
+}
+
+inline long random(long howbig) {
+  if (howbig <= 0)
+    return 0;
+  // xorshift32, deterministic for a given seed
+  host_random_state ^= host_random_state << 13;
+  host_random_state ^= host_random_state >> 17;
+  host_random_state ^= host_random_state << 5;
+  return host_random_state % howbig;
+}
+
+inline long random(long howsmall, long howbig) {
+  if (howsmall >= howbig)
+    return howsmall;
+  return random(howbig - howsmall) + howsmall;
+}
+
+
+/* ========================================================================= */
+/* serial */
+
+#define HOST_SERIAL_INPUT 64         // bytes of pending serial input
+#define HOST_PRINTF_BUFFER 64        // stack buffer of Print::printf
+
+class HostSerial
+{
+  private:
+    bool _echo = true;              // write output to stdout
+    char _input[HOST_SERIAL_INPUT]; // pending input
+    uint8_t _input_length = 0;
+    uint8_t _input_position = 0;
+
+  public:
+    void begin(unsigned long baud) {}
+
+    void setEcho(bool echo) { _echo = echo; }
+
+    /* queue input, replacing what was not read yet */
+    void setInput(const char* text) {
+      _input_length = snprintf(_input, sizeof(_input), "%s", text);
+      _input_position = 0;
+    }
+
+    int available() { return _input_length - _input_position; }
+
+    int read() { return available() > 0 ? _input[_input_position++] : -1; }
+
+    size_t write(const char* buffer, size_t size) {
+      return _echo ? fwrite(buffer, 1, size, stdout) : size;
+    }
+
+    /* like the arduino-esp32 core: output that does not fit the stack
+       buffer is formatted on the heap (with new, so the bench counts it) */
+    int printf(const char* format, ...) {
+      char buffer[HOST_PRINTF_BUFFER];
+      va_list args;
+      va_start(args, format);
+      int length = vsnprintf(buffer, sizeof(buffer), format, args);
+      va_end(args);
+      if (length < 0)
+        return 0;
+
+      char* text = buffer;
+      if (length >= (int) sizeof(buffer)) {
+        text = new char[length + 1];
+        va_start(args, format);
+        vsnprintf(text, length + 1, format, args);
+        va_end(args);
+      }
+      write(text, length);
+      if (text != buffer)
+        delete[] text;
+      return length;
+    }
+
+    void print(const char* text) { write(text, strlen(text)); }
+
+    void println(const char* text = "") { print(text); write("\n", 1); }
+};
+
+inline HostSerial Serial;
+
+inline void host_serial_input(const char* text) {
+  Serial.setInput(text);
+}
@@ -0,0 +1,153 @@
+/** ===========================================================================
+  NeoPixelBus.h (host stand-in)
+
+  In-process replacement of the NeoPixelBus library. Pixels are stored in
+  GRBW wire order just like on the lamp, so SetPixelColor/GetPixelColor pay
+  the same packing cost. Show() copies the wire buffer into a "sent" buffer
+  instead of driving a pin.
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+
+/**----------------------------------------------------------------------------
+  RgbwColor
+
+  RGBW color with 8 bits per channel.
+*/
+struct RgbwColor
+{
+  uint8_t R, G, B, W;
+
+  RgbwColor() {}
+
+  RgbwColor(uint8_t r, uint8_t g, uint8_t b, uint8_t w = 0) :
+    R(r), G(g), B(b), W(w)
+  {}
+
+  RgbwColor(uint8_t brightness) :
+    R(0), G(0), B(0), W(brightness)
+  {}
+
+  /* same rounding as the library: (value * (ratio + 1)) >> 8 */
+  RgbwColor Dim(uint8_t ratio) const {
+    return RgbwColor(
+             _elementDim(R, ratio),
+             _elementDim(G, ratio),
+             _elementDim(B, ratio),
+             _elementDim(W, ratio)
+           );
+  }
+
+  bool operator==(const RgbwColor& other) const {
+    return R == other.R && G == other.G && B == other.B && W == other.W;
+  }
+
+  bool operator!=(const RgbwColor& other) const {
+    return !(*this == other);
+  }
+
+  private:
+    static uint8_t _elementDim(uint8_t value, uint8_t ratio) {
+      return (static_cast<uint16_t>(value) * (static_cast<uint16_t>(ratio) + 1)) >> 8;
+    }
+};
+
+
+/**----------------------------------------------------------------------------
+  NeoGrbwFeature
+
+  Wire layout of SK6812 RGBW pixels.
+*/
+class NeoGrbwFeature
+{
+  public:
+    typedef RgbwColor ColorObject;
+    static const size_t PixelSize = 4;
+
+    static void applyPixelColor(uint8_t* pixels, uint16_t n, ColorObject color) {
+      uint8_t* p = pixels + n * PixelSize;
+      *p++ = color.G;
+      *p++ = color.R;
+      *p++ = color.B;
+      *p = color.W;
+    }
+
+    static ColorObject retrievePixelColor(const uint8_t* pixels, uint16_t n) {
+      const uint8_t* p = pixels + n * PixelSize;
+      ColorObject color;
+      color.G = *p++;
+      color.R = *p++;
+      color.B = *p++;
+      color.W = *p;
+      return color;
+    }
+};
+
+
+/* SK6812 timing, nothing to do on the host */
+class NeoSk6812Method {};
+
+
+/**----------------------------------------------------------------------------
+  NeoPixelBus
+
+  Pixel strip. Only the interface used by the sketch is provided.
+*/
+template<typename T_COLOR_FEATURE, typename T_METHOD>
+class NeoPixelBus
+{
+  private:
+    uint16_t _count;
+    uint8_t* _pixels;               // current wire buffer
+    uint8_t* _sent;                 // last shown wire buffer
+    uint32_t _show_count;
+
+  public:
+    NeoPixelBus(uint16_t count, uint8_t pin) :
+      _count(count),
+      _pixels(new uint8_t[count * T_COLOR_FEATURE::PixelSize]()),
+      _sent(new uint8_t[count * T_COLOR_FEATURE::PixelSize]()),
+      _show_count(0)
+    {}
+
+    ~NeoPixelBus() {
+      delete[] _pixels;
+      delete[] _sent;
+    }
+
+    void Begin() {}
+
+    void Show() {
+      memcpy(_sent, _pixels, PixelsSize());
+      _show_count++;
+    }
+
+    bool CanShow() const { return true; }
+
+    uint16_t PixelCount() const { return _count; }
+
+    uint8_t* Pixels() { return _pixels; }
+
+    size_t PixelsSize() const { return _count * T_COLOR_FEATURE::PixelSize; }
+
+    void SetPixelColor(uint16_t n, typename T_COLOR_FEATURE::ColorObject color) {
+      if (n < _count)
+        T_COLOR_FEATURE::applyPixelColor(_pixels, n, color);
+    }
+
+    typename T_COLOR_FEATURE::ColorObject GetPixelColor(uint16_t n) const {
+      if (n < _count)
+        return T_COLOR_FEATURE::retrievePixelColor(_pixels, n);
+      return typename T_COLOR_FEATURE::ColorObject(0);
+    }
+
+    /* host only: wire bytes of the last Show() */
+    const uint8_t* SentPixels() const { return _sent; }
+
+    /* host only: amount of Show() calls */
+    uint32_t ShowCount() const { return _show_count; }
+};
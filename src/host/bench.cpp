@@ -0,0 +1,1891 @@
+/** ===========================================================================
+  bench.cpp
+
+  Host-native benchmark of the led_control sketch. The sketch is compiled
+  against the stand-ins in this directory (Arduino.h, NeoPixelBus.h,
+  esp_partition.h) and every animation is rendered for a few thousand frames at
+  scripted BRIGHTNESS/MOD inputs.
+
+  Reported per animation and input script (ns per frame):
+    update                          Animation::update()
+    draw                            Animation::draw()
+    show                            show()
+    frame                           update + draw + show
+    transition                      animation_transition() during a switch,
+                                    including draw() of both animations
+    t-frame                         whole frame while transitioning
+
+  Afterwards, the pixel primitives are measured on their own (ns per call)
+  and optimized kernels are checked against their reference versions. The
+  exit code is non-zero if a kernel deviates more than allowed.
+
+  Budget percentages are relative to FRAME_DELAY on the host. The ESP32 is a
+  lot slower, so use them to compare animations, not as absolute numbers.
+
+  Finally, a recorded input trace is replayed and every frame is compared
+  against golden frames (see check_golden()), so any change of the rendered
+  output shows up. Changes that alter the output on purpose have to write
+  new golden frames with -w.
+
+  Usage:
+    bench [-f frames] [-m max_milliamps] [-g golden] [-w] [-t trace] [-e error]
+
+    -f frames                       frames per animation and script
+    -m max_milliamps                current limit for show(), 0 = unlimited
+    -g golden                       golden frames, default: golden_frames.txt
+                                    next to the binary
+    -w                              write the golden frames instead
+    -t trace                        with -w: trace dumped by the lamp instead
+                                    of the built-in one
+    -e error                        tolerated channel deviation when frames
+                                    differ: of every pixel of keyframes, and
+                                    of the channel sums of all other frames
+                                    on average per pixel, default: 0 = exact
+*/
+
+#include <Arduino.h>
+
+#define INPUT_TRACING 1             // traces are replayed against golden frames
+
+#include "../led_control/led_control.ino"
+
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <thread>
+
+
+/* ========================================================================= */
+/* helpers */
+
+typedef std::chrono::steady_clock bench_clock;
+
+volatile uint32_t bench_sink;       // keeps results from being optimized out
+
+/* heap allocations of threads that count them, see check_heap() */
+std::atomic<uint32_t> heap_allocations(0);
+thread_local bool counting_heap = false;
+
+void* operator new(size_t size) {
+  if (counting_heap)
+    heap_allocations++;
+  void* memory = malloc(size ? size : 1);
+  if (!memory)
+    throw std::bad_alloc();
+  return memory;
+}
+
+// both sides are replaced, the memory does come from malloc()
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+void operator delete(void* memory) noexcept { free(memory); }
+void operator delete(void* memory, size_t) noexcept { free(memory); }
+#pragma GCC diagnostic pop
+
+inline uint64_t elapsed_ns(bench_clock::time_point start) {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+           bench_clock::now() - start).count();
+}
+
+
+/**----------------------------------------------------------------------------
+  InputScript
+
+  Scripted poti inputs. Static scripts hold BRIGHTNESS and MOD at a fixed
+  value, sweeping scripts move both through their whole range.
+*/
+struct InputScript
+{
+  const char* name;
+  float brightness, mod;
+  bool sweep;
+};
+
+const InputScript SCRIPTS[] = {
+  {"dim/slow",  0.2, 0.1, false},
+  {"mid",       0.5, 0.5, false},
+  {"full/fast", 1.0, 0.9, false},
+  {"sweep",     0.0, 0.0, true}
+};
+
+void apply_script(const InputScript& script, uint32_t frame, uint32_t frames) {
+  float brightness = script.brightness;
+  float mod = script.mod;
+  if (script.sweep) {
+    float phase = 2 * PI * frame / frames;
+    brightness = 0.5 + 0.5 * sin(phase);
+    mod = 0.5 + 0.5 * cos(phase);
+  }
+  host_set_analog(POTI_B_PIN, brightness * 4095);
+  host_set_analog(POTI_M_PIN, mod * 4095);
+}
+
+
+/**----------------------------------------------------------------------------
+  Animations under test, all animations of the sketch (see LampAnimation).
+  Instances are constructed fresh for every script so the constructors see
+  the scripted inputs.
+*/
+const char* const BENCH_ANIMATIONS[] = {
+  "PlainWhite", "HueLight", "DiagBars", "EdgeColors", "MarchEdges", "Layers",
+  "Sparks", "SineWave"
+};
+
+#define BENCH_ANIMATION_COUNT ARRAY_SIZE(BENCH_ANIMATIONS)
+static_assert(BENCH_ANIMATION_COUNT == LampAnimation::COUNT, "one name per animation");
+
+LampAnimation bench_slots[2];       // animation under test and its successor
+
+
+const char* const TRANSITION_NAMES[] = {
+  "wipe", "radial", "flood", "dissolve", "crossfade"
+};
+static_assert(ARRAY_SIZE(TRANSITION_NAMES) == TRANSITION_COUNT, "one name per transition");
+
+
+/* ========================================================================= */
+/* frame benchmark */
+
+struct StageTimes
+{
+  uint64_t update = 0, draw = 0, show = 0;
+  uint64_t transition = 0, transition_frame = 0;
+  uint32_t frames = 0, transition_frames = 0;
+};
+
+/**----------------------------------------------------------------------------
+  bench_frames
+
+  Render a given amount of frames of an animation, followed by a complete
+  transition to the next animation.
+*/
+StageTimes bench_frames(uint8_t anim, const InputScript& script, uint32_t frames) {
+  StageTimes t;
+  bench_clock::time_point start;
+
+  // let the input smoothing settle before constructing
+  for (uint8_t i = 0; i < 64; i++) {
+    apply_script(script, 0, frames);
+    update_inputs();
+  }
+  clear_strip();
+  LampAnimation* animation = &bench_slots[0];
+  LampAnimation* next = &bench_slots[1];
+  animation->emplace(anim);
+  next->emplace((anim + 1) % BENCH_ANIMATION_COUNT);
+
+  for (uint32_t f = 0; f < frames; f++) {
+    apply_script(script, f, frames);
+    update_inputs();
+
+    start = bench_clock::now();
+    animation->update();
+    t.update += elapsed_ns(start);
+
+    start = bench_clock::now();
+    animation->draw();
+    t.draw += elapsed_ns(start);
+
+    start = bench_clock::now();
+    show();
+    t.show += elapsed_ns(start);
+  }
+  t.frames = frames;
+
+  // transition to the next animation
+  ANIMATION_TRANSITION = 1;
+  while (ANIMATION_TRANSITION != 0 && t.transition_frames < frames) {
+    apply_script(script, frames, frames);
+    update_inputs();
+
+    bench_clock::time_point frame_start = bench_clock::now();
+    animation->update();
+
+    start = bench_clock::now();
+    animation_transition(animation, next);
+    t.transition += elapsed_ns(start);
+
+    show();
+    t.transition_frame += elapsed_ns(frame_start);
+    t.transition_frames++;
+  }
+  ANIMATION_TRANSITION = 0;
+  bench_slots[0].reset();
+  bench_slots[1].reset();
+  return t;
+}
+
+void print_frame_results(const char* animation, const char* script, const StageTimes& t) {
+  double budget = FRAME_DELAY * 1e6;
+  double update = (double) t.update / t.frames;
+  double draw   = (double) t.draw / t.frames;
+  double show_t = (double) t.show / t.frames;
+  double frame  = update + draw + show_t;
+  double trans  = t.transition_frames ? (double) t.transition / t.transition_frames : 0;
+  double tframe = t.transition_frames ? (double) t.transition_frame / t.transition_frames : 0;
+
+  printf("%-11s %-10s %9.0f %9.0f %9.0f %9.0f %6.2f%% %11.0f %9.0f %6.2f%%\n",
+         animation, script, update, draw, show_t, frame, 100 * frame / budget,
+         trans, tframe, 100 * tframe / budget);
+}
+
+
+/* ========================================================================= */
+/* primitive micro-benchmarks */
+
+void print_micro_result(const char* name, uint64_t ns, uint32_t calls) {
+  printf("%-24s %12.1f %10u\n", name, (double) ns / calls, calls);
+}
+
+void bench_primitives(uint32_t reps) {
+  bench_clock::time_point start;
+  uint64_t ns;
+  uint32_t sink = 0;
+
+  printf("\n%-24s %12s %10s\n", "primitive", "ns/call", "calls");
+
+  // addPixel
+  clear_strip();
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      addPixel(i, RgbwColor(1, 2, 3, 4));
+    }
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("addPixel", ns, reps * NUM_LEDs);
+
+  // fadeToBlackBy on the framebuffer
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    setSolid(RgbwColor(200, 100, 50, 25));
+    fadeToBlackBy(10);
+  }
+  ns = elapsed_ns(start);
+  uint64_t solid_ns;
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    setSolid(RgbwColor(200, 100, 50, 25));
+  }
+  solid_ns = elapsed_ns(start);
+  print_micro_result("fadeToBlackBy", ns > solid_ns ? ns - solid_ns : 0, reps);
+
+  // fadeToBlackRandom on the framebuffer, against one random() per pixel
+  Rng rng(reps);
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    setSolid(RgbwColor(200, 100, 50, 25));
+    fadeToBlackRandom(rng, 10, 100);
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("fadeToBlackRandom", ns > solid_ns ? ns - solid_ns : 0, reps);
+
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    setSolid(RgbwColor(200, 100, 50, 25));
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      uint8_t amount = random(10, 100);
+      framebuffer.set_packed(i, packed_sub(framebuffer.get_packed(i), packed_splat(amount)));
+    }
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("fadeToBlackRandom(random)", ns > solid_ns ? ns - solid_ns : 0, reps);
+
+  // Hsvw2Rgbw
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps * NUM_LEDs; r++) {
+    RgbwColor c = Hsvw2Rgbw((r % 3600) * 0.1f, 1, 0.7f, 0);
+    sink += c.R + c.G + c.B;
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("Hsvw2Rgbw", ns, reps * NUM_LEDs);
+
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps * NUM_LEDs; r++) {
+    RgbwColor c = Hsvw2Rgbw_reference((r % 3600) * 0.1f, 1, 0.7f, 0);
+    sink += c.R + c.G + c.B;
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("Hsvw2Rgbw_reference", ns, reps * NUM_LEDs);
+
+  // Hsvw2Rgbw batch, per converted color
+  static HsvColor hsv[NUM_LEDs];
+  static RgbwColor rgbw[NUM_LEDs];
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    hsv[i] = {(uint16_t) (i * 13 % HUE_STEPS), 255, (uint8_t) i};
+  }
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    hsv[r % NUM_LEDs].V = r;
+    Hsvw2Rgbw(hsv, rgbw, NUM_LEDs);
+    sink += rgbw[r % NUM_LEDs].R;
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("Hsvw2Rgbw(batch)", ns, reps * NUM_LEDs);
+
+  // calculate_milliamps on the framebuffer
+  setSolid(RgbwColor(200, 100, 50, 25));
+  start = bench_clock::now();
+  for (uint32_t r = 0; r < reps; r++) {
+    // touch one pixel so the scan cannot be hoisted out of the loop
+    setPixel(r % NUM_LEDs, RgbwColor(r, 100, 50, 25));
+    sink += calculate_milliamps();
+  }
+  ns = elapsed_ns(start);
+  print_micro_result("calculate_milliamps", ns, reps);
+
+  // transitions, per frame from begin() to done()
+  static PixelBuffer next;
+  setSolid(RgbwColor(10, 20, 30, 40), next);
+  for (uint8_t k = 0; k < TRANSITION_COUNT; k++) {
+    ArenaScope scope(SCRATCH);
+    Transition* transition = TRANSITIONS[k](SCRATCH);
+    uint32_t steps = 0;
+    start = bench_clock::now();
+    for (uint32_t r = 0; r < max(reps / 50, 1u); r++) {
+      transition->begin(r % 2 ? -1 : 1);
+      while (!transition->done()) {
+        transition->step();
+        transition->compose(next, framebuffer);
+        steps++;
+      }
+    }
+    ns = elapsed_ns(start);
+    transition->~Transition();
+    char name[32];
+    snprintf(name, sizeof(name), "transition(%s)", TRANSITION_NAMES[k]);
+    print_micro_result(name, ns, steps);
+  }
+
+  // fused shader kernels, per frame
+  {
+    using namespace shader;
+    auto corners = gradient(
+      gradient(RgbwColor(200, 10, 0, 0), RgbwColor(0, 200, 10, 0), coord_u()),
+      gradient(RgbwColor(10, 0, 200, 0), RgbwColor(0, 0, 0, 200), coord_u()),
+      coord_v()
+    );
+    start = bench_clock::now();
+    for (uint32_t r = 0; r < reps; r++) {
+      corners.a.a.value = r;
+      setShader(corners);
+    }
+    ns = elapsed_ns(start);
+    print_micro_result("setShader(bilinear)", ns, reps);
+
+    start = bench_clock::now();
+    for (uint32_t r = 0; r < reps; r++) {
+      setShader(hue_map(sum(r, fraction(coord_u(), HUE_STEPS)), 255,
+                        band(coord_v(), wave(coord_x(), SINE_FREQUENCY, r * 400), SINE_WIDTH)));
+    }
+    ns = elapsed_ns(start);
+    print_micro_result("setShader(wave)", ns, reps);
+    sink += framebuffer.get_packed(reps % NUM_LEDs);
+  }
+
+  // a full particle system, update and render per frame
+  static ParticleSystem<SPARK_COUNT> particles;
+  Rng particle_rng(reps);
+  uint64_t update_ns = 0, render_ns = 0;
+  clear_strip();
+  for (uint32_t r = 0; r < reps; r++) {
+    while (particles.spawn(particle_rng.below(EDGE_COUNT), 0,
+                           particle_rng.between(-PARTICLE_MAX_SPEED, PARTICLE_MAX_SPEED),
+                           particle_rng.below(HUE_STEPS), 64 + particle_rng.below(192))) {}
+    start = bench_clock::now();
+    particles.update(particle_rng);
+    update_ns += elapsed_ns(start);
+    start = bench_clock::now();
+    particles.render(framebuffer, PARTICLE_ONE * 3 / 2);
+    render_ns += elapsed_ns(start);
+  }
+  print_micro_result("particles(256).update", update_ns, reps);
+  print_micro_result("particles(256).render", render_ns, reps);
+
+  bench_sink = sink;
+}
+
+
+/* ========================================================================= */
+/* differential checks */
+
+/**----------------------------------------------------------------------------
+  check_hsvw
+
+  Compare the fixed-point Hsvw2Rgbw against the float reference over the
+  whole 8-bit saturation/value range and a fine hue grid.
+
+  Returns:
+    uint8_t                         max channel deviation found.
+*/
+uint8_t check_hsvw() {
+  uint8_t worst = 0;
+  for (uint16_t h = 0; h <= 3600; h += 3) {
+    for (uint16_t s = 0; s < 256; s += 5) {
+      for (uint16_t v = 0; v < 256; v++) {
+        RgbwColor a = Hsvw2Rgbw(h * 0.1f, s / 255.0f, v / 255.0f, v / 255.0f);
+        RgbwColor b = Hsvw2Rgbw_reference(h * 0.1f, s / 255.0f, v / 255.0f, v / 255.0f);
+        worst = max(worst, (uint8_t) abs(a.R - b.R));
+        worst = max(worst, (uint8_t) abs(a.G - b.G));
+        worst = max(worst, (uint8_t) abs(a.B - b.B));
+        worst = max(worst, (uint8_t) abs(a.W - b.W));
+      }
+    }
+  }
+  return worst;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_packed
+
+  Compare the SWAR color operations against their scalar references. Every
+  channel sees every combination of 8 bit operands.
+
+  Returns:
+    true                            if all results match.
+*/
+bool check_packed() {
+  for (uint16_t x = 0; x < 256; x++) {
+    for (uint16_t y = 0; y < 256; y++) {
+      PackedColor a = pack(RgbwColor(x, y, 255 - x, x ^ y));
+      PackedColor b = pack(RgbwColor(y, x, x ^ y, 255 - y));
+      if (packed_add(a, b) != packed_add_reference(a, b) ||
+          packed_sub(a, b) != packed_sub_reference(a, b) ||
+          packed_max(a, b) != packed_max_reference(a, b) ||
+          packed_mul(a, b) != packed_mul_reference(a, b) ||
+          packed_screen(a, b) != packed_screen_reference(a, b) ||
+          packed_scale(a, y) != packed_scale_reference(a, y) ||
+          packed_channel_sum(a) != channelSum(unpack(a)))
+        return false;
+      // lerp may be off by one in between, but never at the ends
+      PackedColor lerp = packed_lerp(a, b, y), lerp_ref = packed_lerp_reference(a, b, y);
+      if (packed_sub(lerp, lerp_ref) & 0xfefefefe || packed_sub(lerp_ref, lerp) & 0xfefefefe ||
+          packed_lerp(a, b, 0) != a || packed_lerp(a, b, 255) != b)
+        return false;
+    }
+  }
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_projections
+
+  Compare projection band queries against testing every pixel.
+
+  Returns:
+    true                            if every band holds exactly the pixels
+                                    a full scan finds.
+*/
+bool check_projections() {
+  const Projection* projections[] = {&PROJ_X, &PROJ_Y, &PROJ_SUM, &PROJ_DIFF};
+  const int8_t facs[][2] = {{1, 0}, {0, 1}, {1, 1}, {1, -1}};
+  for (uint8_t p = 0; p < 4; p++) {
+    for (int32_t center = -900; center < 2700; center += 37) {
+      for (int32_t radius = 1; radius < 200; radius += 23) {
+        PixelSpan span = projections[p]->band(center, radius);
+        bool inside[NUM_LEDs] = {};
+        for (uint16_t i = 0; i < span.count; i++) {
+          inside[span.pixels[i]] = true;
+        }
+        for (uint16_t i = 0; i < NUM_LEDs; i++) {
+          int32_t key = facs[p][0] * pixel_x(i) + facs[p][1] * pixel_y(i);
+          if (inside[i] != (abs(key - center) < radius))
+            return false;
+        }
+      }
+    }
+  }
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_lamp_tables
+
+  Compare the compile time coordinate tables against the math library.
+
+  Returns:
+    true                            if all entries are within 1 step.
+*/
+bool check_lamp_tables() {
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    double dx = lamp[i].x - LAMP_CENTER_X;
+    double dy = lamp[i].y - LAMP_CENTER_Y;
+    double turns = atan2(dy, dx) / (2 * PI);
+    if (turns < 0)
+      turns += 1;
+    int32_t angle = lround(turns * 65536) & 0xffff;
+    int32_t angle_error = abs(angle - pixel_angle(i));
+    angle_error = min(angle_error, 65536 - angle_error);
+    if (pixel_x(i) != lamp[i].x || pixel_y(i) != lamp[i].y ||
+        abs((int32_t) pixel_u(i) - (int32_t) lround(lamp[i].x * 65535.0 / lamp_x)) > 1 ||
+        abs((int32_t) pixel_v(i) - (int32_t) lround(lamp[i].y * 65535.0 / lamp_y)) > 1 ||
+        angle_error > 1 ||
+        abs(pixel_radius(i) - lround(sqrt(dx * dx + dy * dy))) > 1)
+      return false;
+  }
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_topology
+
+  Check that edge, vertex and pixel tables of the lamp graph agree.
+
+  Returns:
+    true                            if the tables are consistent.
+*/
+bool check_topology() {
+  for (uint8_t e = 0; e < EDGE_COUNT; e++) {
+    for (bool start : {EDGE_START, EDGE_END}) {
+      uint8_t v = edge_vertex(e, start);
+      uint16_t pixel = start ? E[e].get_start() : E[e].get_end();
+      if (get_vertex_index_of(pixel) != v)
+        return false;
+      bool listed = false;
+      for (uint8_t k = 0; k < V[v].get_size(); k++) {
+        listed |= V[v].get_edges()[k] == e && V[v].get_indices()[k] == pixel &&
+                  V[v].get_edge_starts()[k] == start;
+      }
+      if (!listed)
+        return false;
+    }
+  }
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    const Edge& edge = E[pixel_edge(i)];
+    bool end_point = i == edge.get_start() || i == edge.get_end();
+    if (edge.get_start() + pixel_edge_offset(i) != i || (pixel_vertex(i) >= 0) != end_point)
+      return false;
+  }
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_walker
+
+  Walk the lamp graph with every policy and check that each step continues
+  at the vertex the previous edge led to and never turns back when told so.
+
+  Returns:
+    true                            if all walks are valid.
+*/
+bool check_walker() {
+  for (uint8_t policy : {WALK_RANDOM, WALK_NO_BACKTRACK, WALK_WEIGHTED,
+                         WALK_NO_BACKTRACK | WALK_WEIGHTED}) {
+    Rng rng(policy);
+    EdgeWalker walker(rng);
+    for (uint32_t step = 0; step < 100000; step++) {
+      uint8_t edge = walker.get_edge();
+      uint8_t target = walker.get_target();
+      walker.advance(rng, policy);
+      if (walker.get_origin() != target)
+        return false;
+      if ((policy & WALK_NO_BACKTRACK) && V[target].get_size() > 1 && walker.get_edge() == edge)
+        return false;
+      if (E[walker.get_edge()].get_start() + (walker.is_forward() ? 0 : E[walker.get_edge()].get_length()) != walker.get_first_pixel())
+        return false;
+    }
+  }
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_particles
+
+  Move particles at all speeds over the lamp graph. Each frame, every
+  particle has to travel exactly its speed along the graph, continue at the
+  vertex it reached without turning back, and stay on its edge. Particles
+  have to die with their life, and rendering has to add exactly the covered
+  fraction of a particle's color without leaking past its edge.
+
+  Returns:
+    true                            if all particles behave.
+*/
+bool check_particles() {
+  static ParticleSystem<SPARK_COUNT> particles;
+  Rng rng(24);
+  bool ok = true;
+
+  particles.clear();
+  for (uint16_t n = 0; n < SPARK_COUNT; n++) {
+    uint8_t edge = rng.below(EDGE_COUNT);
+    ok &= particles.spawn(edge, rng.below(particle_edge_span(edge)),
+                          rng.between(-PARTICLE_MAX_SPEED, PARTICLE_MAX_SPEED + 1),
+                          rng.below(HUE_STEPS), 200);
+  }
+  ok &= !particles.spawn(0, 0, 1, 0, 1);
+
+  static uint8_t edges[SPARK_COUNT];
+  static int16_t positions[SPARK_COUNT], velocities[SPARK_COUNT];
+  for (uint16_t f = 0; f < 150; f++) {
+    for (uint16_t i = 0; i < SPARK_COUNT; i++) {
+      edges[i] = particles.get_edge(i);
+      positions[i] = particles.get_position(i);
+      velocities[i] = particles.get_velocity(i);
+    }
+    particles.update(rng);
+    ok &= particles.get_count() == SPARK_COUNT;
+
+    for (uint16_t i = 0; i < SPARK_COUNT; i++) {
+      uint8_t edge = particles.get_edge(i);
+      int16_t position = particles.get_position(i);
+      int16_t velocity = particles.get_velocity(i);
+      ok &= edge < EDGE_COUNT && position >= 0 && position < particle_edge_span(edge);
+      ok &= abs(velocity) == abs(velocities[i]);
+      int16_t moved = positions[i] + velocities[i];
+      if (edge == edges[i]) {
+        ok &= position == moved && velocity == velocities[i];
+        continue;
+      }
+      // entered the new edge at the vertex the old one led to
+      bool forward = velocities[i] > 0;
+      int16_t overshoot = forward ? moved - particle_edge_span(edges[i]) : -1 - moved;
+      int16_t entered = velocity > 0 ? position : particle_edge_span(edge) - 1 - position;
+      ok &= overshoot == entered;
+      ok &= edge_vertex(edges[i], forward ? EDGE_END : EDGE_START) ==
+            edge_vertex(edge, velocity > 0 ? EDGE_START : EDGE_END);
+    }
+  }
+  for (uint16_t f = 0; f < 50; f++) {
+    particles.update(rng);
+  }
+  ok &= particles.get_count() == 0;
+
+  // one and a half pixels of full red, in the middle and at both edge ends
+  static PixelBuffer target;
+  uint8_t edge = 7;
+  for (int16_t position : {(int16_t) (5 * PARTICLE_ONE + 100), (int16_t) 0,
+                           (int16_t) (particle_edge_span(edge) - 1)}) {
+    particles.clear();
+    particles.spawn(edge, position, 0, 0, 255);
+    target.clear();
+    particles.render(target, PARTICLE_ONE * 3 / 2);
+    uint32_t red = 0;
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      RgbwColor c = target.get(i);
+      red += c.R;
+      bool inside = i >= E[edge].get_start() && i <= E[edge].get_end();
+      ok &= inside || (c.R | c.G | c.B | c.W) == 0;
+    }
+    int16_t from = max(position - PARTICLE_ONE * 3 / 4, 0);
+    int16_t to = min(position + PARTICLE_ONE * 3 / 4, (int) particle_edge_span(edge));
+    uint32_t expected = 255 * (to - from) / PARTICLE_ONE;
+    ok &= red <= expected + 1 && red + 3 >= expected;
+  }
+  particles.clear();
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_shaders
+
+  Shader kernels have to compute what the hand-written loops did: the sine
+  wave has to follow sin(), lerp8() has to hit both ends, gradients have
+  to interpolate like lerp8() and hues have to wrap around. A fused
+  expression has to give the same frame as running its stages as separate
+  passes.
+
+  Returns:
+    true                            if all kernels are correct.
+*/
+bool check_shaders() {
+  using namespace shader;
+  bool ok = true;
+
+  int32_t wave_error = 0;
+  for (uint32_t phase = 0; phase < 65536; phase++) {
+    int32_t exact = lround((sin(phase * 2 * PI / 65536) + 1) / 2 * 65535);
+    wave_error = max(wave_error, abs(exact - wave16(phase)));
+  }
+  ok &= wave_error <= 131;
+
+  for (uint16_t a = 0; a < 256; a++) {
+    for (uint16_t b = 0; b < 256; b += 15) {
+      ok &= lerp8(a, b, 0) == a && lerp8(a, b, 65535) == b && lerp8(a, a, b * 257) == a;
+      ok &= abs(lerp8(a, b, 32768) - (int) lround((a * 32767.0 + b * 32768.0) / 65535)) <= 1;
+    }
+  }
+
+  RgbwColor c[4] = {RgbwColor(200, 10, 0, 30), RgbwColor(0, 200, 10, 255),
+                    RgbwColor(10, 0, 200, 0), RgbwColor(255, 255, 0, 1)};
+  auto corners = gradient(gradient(c[0], c[1], coord_u()), gradient(c[3], c[2], coord_u()), coord_v());
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    uint8_t expected[4];
+    for (uint8_t ch = 0; ch < 4; ch++) {
+      const uint8_t* bottom[2] = {&c[0].R, &c[1].R}, * top[2] = {&c[3].R, &c[2].R};
+      expected[ch] = lerp8(lerp8(bottom[0][ch], bottom[1][ch], pixel_u(i)),
+                           lerp8(top[0][ch], top[1][ch], pixel_u(i)), pixel_v(i));
+    }
+    ok &= corners(i) == pack(RgbwColor(expected[0], expected[1], expected[2], expected[3]));
+  }
+
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    ok &= hue_map(sum(HUE_STEPS, 100), 200, 255)(i) == pack(Hsvw2Rgbw((uint16_t) 100, 200, 255, 0));
+    ok &= hue_map(fraction(coord_u(), HUE_STEPS), 255, 0)(i) == 0;
+  }
+
+  // two bars on a fading frame, fused and as separate passes
+  static PixelBuffer fused, passes;
+  Rng rng(25);
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    fused.set_packed(i, rng.next());
+  }
+  passes = fused;
+  auto bar_sum = hue_map(300, 200, band(coord_linear(1, 1), 400, 50));
+  auto bar_diff = hue_map(1000, 255, band(coord_linear(1, -1), -20, 80));
+  setShader(add(add(fade(previous(fused), 10), bar_sum), bar_diff), fused);
+  fadeToBlackBy(10, passes);
+  addShader(PROJ_SUM.band(400, 50), bar_sum, passes);
+  addShader(PROJ_DIFF.band(-20, 80), bar_diff, passes);
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    ok &= fused.get_packed(i) == passes.get_packed(i);
+  }
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_pipeline
+
+  Push numbered frames through a FramePipeline from one thread to another.
+  Every frame is filled with its number, and its brightness and dither flag
+  are derived from it, so the consumer can check that no frame is lost,
+  reordered or overwritten while it is being read, and that the output
+  settings stay with their frame.
+
+  Returns:
+    true                            if all frames arrived intact and in order.
+*/
+bool check_pipeline(uint32_t frames) {
+  static FramePipeline test_pipeline;
+  std::atomic<bool> ok(true);
+
+  std::thread consumer([&]() {
+    for (uint32_t f = 0; f < frames; f++) {
+      const PipelineFrame* frame;
+      while ((frame = test_pipeline.acquire_read()) == NULL) {
+        pipeline_wait();
+      }
+      PackedColor expected = packed_splat(f);
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        if (frame->pixels.get_packed(i) != expected)
+          ok = false;
+      }
+      if (frame->pixels.channel_sum() != NUM_LEDs * packed_channel_sum(expected))
+        ok = false;
+      if (frame->brightness != (uint16_t) (f * 257) || frame->dither != (f & 1))
+        ok = false;
+      test_pipeline.release();
+    }
+  });
+
+  for (uint32_t f = 0; f < frames; f++) {
+    PipelineFrame* slot;
+    while ((slot = test_pipeline.acquire_write()) == NULL) {
+      pipeline_wait();
+    }
+    setSolid(unpack(packed_splat(f)), slot->pixels);
+    slot->brightness = f * 257;
+    slot->dither = f & 1;
+    test_pipeline.publish();
+  }
+  consumer.join();
+  return ok && test_pipeline.get_published() == frames;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_scheduler
+
+  Drive FrameSchedulers with synthetic timestamps: steady frames, a single
+  slow frame under both overrun policies and the micros() wrap around.
+
+  Returns:
+    true                            if deadlines and statistics are as expected.
+*/
+bool check_scheduler() {
+  bool ok = true;
+
+  for (uint32_t begin : {0u, 0xfffff000u}) {
+    // steady frames of 300 us with a small wake up delay stay on the grid
+    FrameScheduler steady(1000);
+    steady.begin_frame(begin);
+    uint32_t now = steady.end_frame(begin + 300);
+    for (uint32_t f = 2; f <= 100; f++) {
+      steady.begin_frame(now + 20);
+      now = steady.end_frame(now + 320);
+      ok &= now == begin + f * 1000;
+    }
+    ok &= steady.get_overruns() == 0 && steady.get_worst() == 300 &&
+          steady.get_max_jitter() == 20;
+
+    // dropping: a 2500 us frame skips two deadlines and realigns to the grid
+    FrameScheduler drop(1000, SCHEDULE_DROP);
+    drop.begin_frame(begin);
+    now = drop.end_frame(begin + 2500);
+    ok &= now == begin + 3000 && drop.get_overruns() == 1 && drop.get_dropped() == 2;
+
+    // catching up: the missed deadlines are kept and run back to back
+    FrameScheduler catch_up(1000, SCHEDULE_CATCH_UP);
+    catch_up.begin_frame(begin);
+    now = catch_up.end_frame(begin + 2500);
+    ok &= now == begin + 1000 && catch_up.get_dropped() == 0;
+    catch_up.begin_frame(begin + 2500);
+    now = catch_up.end_frame(begin + 2600);
+    ok &= now == begin + 2000;
+    catch_up.begin_frame(begin + 2600);
+    now = catch_up.end_frame(begin + 2700);
+    ok &= now == begin + 3000 && catch_up.get_overruns() == 2 &&
+          catch_up.get_max_jitter() == 1500;
+  }
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_transitions
+
+  Run every transition in both directions from a random frame to a solid
+  one. Each pixel has to be revealed exactly once, the transition has to end
+  in time and the last frame has to be the next animation without any glow.
+
+  Returns:
+    true                            if all transitions behave.
+*/
+bool check_transitions() {
+  static PixelBuffer next, target;
+  setSolid(RgbwColor(12, 34, 56, 78), next);
+  bool ok = true;
+
+  for (uint8_t k = 0; k < TRANSITION_COUNT; k++) {
+    for (int8_t direction : {-1, 1}) {
+      ArenaScope scope(SCRATCH);
+      Transition* transition = TRANSITIONS[k](SCRATCH);
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        target.set(i, RgbwColor(random(256), random(256), random(256), random(256)));
+      }
+
+      transition->begin(direction);
+      uint16_t frames = 0, revealed = 0;
+      while (!transition->done() && frames < 1000) {
+        transition->step();
+        transition->compose(next, target);
+        frames++;
+
+        // the mask only grows, revealed pixels show the next frame plus glow
+        const PixelMask& mask = transition->get_mask();
+        ok &= mask.count() >= revealed;
+        revealed = mask.count();
+        for (uint16_t i = 0; i < NUM_LEDs; i++) {
+          if (mask.get(i) && packed_sub(next.get_packed(i), target.get_packed(i)) != 0)
+            ok = false;
+        }
+      }
+
+      uint16_t counted = 0;
+      transition->get_mask().for_each([&](uint16_t pixel) { counted++; });
+      ok &= frames < 1000 && counted == transition->get_mask().count();
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        ok &= target.get_packed(i) == next.get_packed(i);
+      }
+      transition->~Transition();
+    }
+  }
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_masked_render
+
+  Render every animation in full and masked from the same state. Masked
+  pixels have to match the full render, all others have to stay untouched.
+
+  Returns:
+    true                            if masked renders match full renders.
+*/
+bool check_masked_render() {
+  static PixelBuffer full, masked, scratch;
+  PixelMask mask;
+  for (uint16_t i = 0; i < NUM_LEDs; i += 3) {
+    mask.set(i);
+  }
+  PackedColor untouched = pack(RgbwColor(1, 2, 3, 4));
+  bool ok = true;
+
+  LampAnimation* animation = &bench_slots[0];
+  for (uint8_t a = 0; a < BENCH_ANIMATION_COUNT; a++) {
+    animation->emplace(a);
+    for (uint8_t f = 0; f < 10; f++) {
+      animation->update();
+    }
+    full.clear();
+    scratch.clear();
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      masked.set_packed(i, untouched);
+    }
+
+    animation->render(full);
+    animation->render_masked(masked, mask, scratch);
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      ok &= masked.get_packed(i) == (mask.get(i) ? full.get_packed(i) : untouched);
+    }
+  }
+  animation->reset();
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_compositor
+
+  Stack two layers of fixed colors in every blend mode and compare the fused
+  pass against blending the layers one after another. A half covered pixel
+  over a bright background has to show both, a black one only the
+  background and a full one only itself.
+
+  Returns:
+    true                            if every pixel matches.
+*/
+class PatternLayer : public Animation<PatternLayer>
+{
+  private:
+    uint8_t _seed;
+
+  public:
+    PatternLayer(uint8_t seed) : _seed(seed) {}
+
+    void update() {}
+
+    void render(PixelBuffer& target)
+    {
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        // every fourth pixel black, to test transparency
+        uint8_t v = i % 4 ? i * _seed : 0;
+        target.set(i, RgbwColor(v, v * 3, v ^ _seed, i % 4 ? 255 - v : 0));
+      }
+    }
+};
+
+bool check_compositor() {
+  static PixelBuffer bottom, top, fused;
+  PatternLayer a(7), b(13);
+  a.render(bottom);
+  b.render(top);
+  bool ok = true;
+
+  for (uint8_t mode : {BLEND_ADD, BLEND_MAX, BLEND_MULTIPLY, BLEND_SCREEN, BLEND_OVER}) {
+    for (uint8_t opacity : {0, 100, 255}) {
+      Compositor<PatternLayer, PatternLayer> layers({{BLEND_OVER, 200}, {mode, opacity}}, {a, b});
+      layers.render(fused);
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        PackedColor expected = blend(BLEND_OVER, 200, 0, bottom.get_packed(i));
+        expected = blend(mode, opacity, expected, top.get_packed(i));
+        ok &= fused.get_packed(i) == expected;
+      }
+    }
+  }
+
+  // red at half coverage over a bright background
+  RgbwColor over = unpack(blend(BLEND_OVER, 255, pack(RgbwColor(200, 220, 240, 180)),
+                                pack(RgbwColor(128, 0, 0, 0))));
+  auto near = [](uint8_t value, float exact) { return fabs(value - exact) <= 1; };
+  ok &= near(over.R, 128 + 200 * 127 / 255.0) && near(over.G, 220 * 127 / 255.0)
+        && near(over.B, 240 * 127 / 255.0) && near(over.W, 180 * 127 / 255.0);
+  PackedColor background = pack(RgbwColor(200, 220, 240, 180));
+  PackedColor opaque = pack(RgbwColor(10, 255, 0, 30));
+  ok &= blend(BLEND_OVER, 255, background, 0) == background;
+  ok &= blend(BLEND_OVER, 255, background, opaque) == opaque;
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_change_detection
+
+  Static animations must not need drawing while their inputs stay the same,
+  and drawing them again must leave the framebuffer clean. A changed input
+  or an animated scene always needs drawing. Brightness changes have to
+  reach the output without drawing.
+
+  Returns:
+    true                            if changes are detected as expected.
+*/
+bool check_change_detection() {
+  InputScript still = {"still", 0.6, 0.3, false};
+  for (uint8_t i = 0; i < 200; i++) {
+    apply_script(still, 0, 1);
+    update_inputs();
+  }
+  static OutputStage output;
+  bool ok = output.set_brightness(0.5) && !output.set_brightness(0.5);
+
+  auto check = [&](auto& animation) {
+    animation.invalidate();
+    ok &= animation.needs_draw();
+    animation.draw();
+    framebuffer.clear_dirty();
+    ok &= !animation.needs_draw();
+    animation.draw();
+    ok &= !framebuffer.is_dirty();
+
+    MOD += 0.01;
+    ok &= animation.needs_draw();
+    animation.draw();
+    ok &= framebuffer.is_dirty() && !animation.needs_draw();
+    MOD -= 0.01;
+  };
+  PlainWhite white;
+  HueLight hue;
+  check(white);
+  check(hue);
+
+  DiagBars bars;
+  bars.draw();
+  ok &= bars.needs_draw();
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_output_stage
+
+  Check the output stage: gamma tables are monotonic and map full scale to
+  full scale, dithering averages to the exact 16 bit value over a cycle and
+  the current limit holds for the gamma corrected output.
+
+  Returns:
+    true                            if the output behaves.
+*/
+bool check_output_stage() {
+  static OutputStage output;
+  bool ok = true;
+
+  // monotonic, exact at both ends
+  uint8_t last = 0;
+  for (uint16_t v = 0; v < 256; v++) {
+    RgbwColor c = output.map(packed_splat(v), 0, 65535);
+    ok &= c.R >= last && c.R == c.W;
+    last = c.R;
+  }
+  ok &= output.map(0, 0, 65535).R == 0 && output.map(packed_splat(255), 0, 65535).R == 255;
+
+  // dithered values average to the 16 bit value
+  output.set_dither(true);
+  for (uint16_t v = 1; v < 256; v += 7) {
+    for (uint16_t scale : {65535, 9000, 700}) {
+      uint32_t sum = 0;
+      for (uint8_t f = 0; f < DITHER_FRAMES; f++) {
+        output.begin_frame();
+        sum += output.map(packed_splat(v), 0, scale).G;
+      }
+      double exact = 65535 * pow(v / 255.0, GAMMA_RGB) * scale / 65536 / 256;
+      ok &= fabs((double) sum / DITHER_FRAMES - exact) <= 0.5 / DITHER_FRAMES + 1.0 / 256;
+    }
+  }
+  output.set_dither(false);
+
+  // current limit on a bright frame
+  static PixelBuffer frame;
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    frame.set(i, RgbwColor(255, 200, i % 256, 128));
+  }
+  for (float limit : {500.0f, 3000.0f, 100000.0f}) {
+    uint16_t scale = output.limit_current(frame, 65535, limit);
+    uint32_t sum = 0;
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      sum += channelSum(output.map(frame.get_packed(i), i, scale));
+    }
+    ok &= sum * 20 / 255 <= limit && (limit < 100000 || scale == 65535);
+  }
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_input_sampler
+
+  Check the input filters and the snapshot: the first sample is taken as is,
+  short spikes are removed by the median, a step settles with the expected
+  time constant, and snapshots taken while another thread samples always
+  hold both values of the same sample.
+
+  Returns:
+    true                            if the inputs are filtered as expected.
+*/
+bool check_input_sampler() {
+  static InputSampler sampler;
+  host_set_analog(POTI_B_PIN, 1024);
+  host_set_analog(POTI_M_PIN, 3072);
+  sampler.sample();
+  InputSnapshot s = sampler.snapshot();
+  bool ok = s.brightness == 0.25f && s.mod == 0.75f;
+
+  // spikes shorter than half the median window are ignored
+  for (uint8_t n = 0; n < 20; n++) {
+    host_set_analog(POTI_B_PIN, n % INPUT_MEDIAN < INPUT_MEDIAN / 2 ? 4095 : 1024);
+    sampler.sample();
+    ok &= sampler.snapshot().brightness == 0.25f;
+  }
+
+  // step response: about 1 - 1/e after one time constant, settled after ten
+  host_set_analog(POTI_B_PIN, 3072);
+  uint16_t tau = (1 << INPUT_FILTER_SHIFT) + INPUT_MEDIAN / 2;
+  for (uint16_t n = 0; n < tau; n++) {
+    sampler.sample();
+  }
+  float progress = (sampler.snapshot().brightness - 0.25f) / 0.5f;
+  ok &= progress > 0.6 && progress < 0.66;
+  for (uint16_t n = 0; n < 9 * tau; n++) {
+    sampler.sample();
+  }
+  ok &= fabs(sampler.snapshot().brightness - 0.75f) < 1 / 4096.0;
+
+  // both potis get the same input, so a consistent snapshot has equal values
+  static InputSampler shared;
+  std::atomic<bool> running(true);
+  std::thread sampling([&]() {
+    for (uint32_t n = 0; running.load(); n++) {
+      uint16_t value = n / 7 % 2 ? 4095 : 0;
+      host_set_analog(POTI_B_PIN, value);
+      host_set_analog(POTI_M_PIN, value);
+      shared.sample();
+    }
+  });
+  for (uint32_t n = 0; n < 200000; n++) {
+    s = shared.snapshot();
+    ok &= s.brightness == s.mod;
+  }
+  running.store(false);
+  sampling.join();
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_rng
+
+  Check the generator against the PCG32 reference sequence, and that
+  bounded numbers and batches stay in range and hit every value equally
+  often, including ranges where a plain modulo would be biased.
+
+  Returns:
+    true                            if the generator behaves.
+*/
+bool check_rng() {
+  // pcg32_srandom_r(&rng, 42, 54) of the PCG reference implementation
+  Rng rng(42);
+  bool ok = true;
+  for (uint32_t expected : {0xa15c02b7u, 0x7b47f409u, 0xba1d3330u, 0x83d2f293u, 0xbfa4784bu, 0xcbed606eu}) {
+    ok &= rng.next() == expected;
+  }
+
+  // seeds repeat
+  Rng a(7), b(7);
+  for (uint16_t n = 0; n < 100; n++) {
+    ok &= a.next() == b.next();
+  }
+
+  // counts of every value within 5 standard deviations of the mean
+  const uint32_t SAMPLES = 600000;
+  for (uint32_t range : {3u, 7u, 100u, 0xc0000000u}) {
+    uint32_t counts[100] = {};
+    for (uint32_t n = 0; n < SAMPLES; n++) {
+      uint32_t r = rng.below(range);
+      ok &= r < range;
+      counts[range > 100 ? r / (range / 2) : r]++;
+    }
+    uint32_t buckets = range > 100 ? 2 : range;
+    for (uint32_t k = 0; k < buckets; k++) {
+      ok &= fabs((double) counts[k] * buckets / SAMPLES - 1) < 5 / sqrt(SAMPLES / buckets);
+    }
+  }
+  ok &= rng.below(0) == 0 && rng.between(5, 5) == 5;
+  for (uint16_t n = 0; n < 1000; n++) {
+    int32_t r = rng.between(-3, 4);
+    ok &= r >= -3 && r < 4;
+  }
+
+  // batches of bytes, 251 values of [0,256) are biased with a modulo
+  static uint8_t values[SAMPLES];
+  uint32_t counts[256] = {};
+  for (uint32_t n = 0; n < SAMPLES; n += 50000) {
+    rng.fill(values + n, 50000, 0, 251);
+  }
+  for (uint32_t n = 0; n < SAMPLES; n++) {
+    ok &= values[n] < 251;
+    counts[values[n]]++;
+  }
+  for (uint16_t k = 0; k < 251; k++) {
+    ok &= fabs((double) counts[k] * 251 / SAMPLES - 1) < 5 / sqrt(SAMPLES / 251);
+  }
+  rng.fill(values, 1000, 10, 13);
+  for (uint16_t n = 0; n < 1000; n++) {
+    ok &= values[n] >= 10 && values[n] < 13;
+  }
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_journal
+
+  Run a journal on a file backed partition: values survive a remount,
+  set() does not touch the flash, rotation spreads the erases over all
+  sectors, and torn records or a sector without (complete) header are
+  ignored.
+
+  Returns:
+    true                            if the journal behaves.
+*/
+bool check_journal() {
+  const char* path = "/tmp/bench_journal.bin";
+  remove(path);
+  const uint32_t SECTORS = 4;
+  esp_partition_t* partition = host_partition_create("bench", SECTORS * JOURNAL_SECTOR, path);
+
+  StateJournal* j = new StateJournal();
+  bool ok = j->begin(partition);
+  uint32_t value = 0;
+  ok &= !j->get(STATE_ANIMATION, value);
+
+  // set() only changes RAM, unchanged values are not written again
+  std::vector<uint8_t> before = partition->data;
+  j->set(STATE_ANIMATION, 3);
+  j->set(1, 0xdeadbeef);
+  ok &= partition->data == before && j->is_dirty();
+  ok &= j->flush_when_idle() && partition->data == before;
+  ok &= j->flush() && !j->is_dirty() && j->get_writes() == 2;
+  j->set(STATE_ANIMATION, 3);
+  ok &= !j->is_dirty();
+
+  // coalesced: many changes, one record
+  for (uint8_t n = 0; n < 50; n++) {
+    j->set(STATE_ANIMATION, n % 6);
+  }
+  ok &= j->flush() && j->get_writes() == 3;
+
+  // a fresh partition object reads the values back from the file
+  esp_partition_t* reopened = host_partition_create("bench", SECTORS * JOURNAL_SECTOR, path);
+  StateJournal* k = new StateJournal();
+  ok &= k->begin(reopened);
+  ok &= k->get(STATE_ANIMATION, value) && value == 49 % 6;
+  ok &= k->get(1, value) && value == 0xdeadbeef;
+
+  // several rotations, every sector is erased about as often
+  for (uint32_t n = 0; n < 10 * JOURNAL_SLOTS; n++) {
+    k->set(STATE_ANIMATION, n);
+    ok &= k->flush();
+  }
+  uint32_t least = UINT32_MAX, most = 0;
+  for (uint32_t s = 0; s < SECTORS; s++) {
+    least = min(least, host_partition_erases(reopened, s));
+    most = max(most, host_partition_erases(reopened, s));
+  }
+  ok &= least >= 2 && most - least <= 1;
+  ok &= k->get_sequence() > 10;
+
+  // a torn record is skipped, the values before it are kept
+  uint8_t sector = k->get_sector();
+  uint32_t offset = sector * JOURNAL_SECTOR + sizeof(JournalHeader);
+  JournalRecord record;
+  while (esp_partition_read(reopened, offset, &record, sizeof(record)) == ESP_OK && record.key != 0xff) {
+    offset += sizeof(record);
+  }
+  JournalRecord torn = {STATE_ANIMATION, 0, 0, 0x12340000};
+  torn.check = journal_check(STATE_ANIMATION, 0x12345678);
+  ok &= esp_partition_write(reopened, offset, &torn, sizeof(torn)) == ESP_OK;
+  StateJournal* l = new StateJournal();
+  ok &= l->begin(reopened);
+  ok &= l->get(STATE_ANIMATION, value) && value == 10 * JOURNAL_SLOTS - 1;
+
+  // a sector whose header was never written does not count
+  uint8_t next = (sector + 1) % SECTORS;
+  ok &= esp_partition_erase_range(reopened, next * JOURNAL_SECTOR, JOURNAL_SECTOR) == ESP_OK;
+  JournalRecord stale = {STATE_ANIMATION, journal_check(STATE_ANIMATION, 7), 0, 7};
+  ok &= esp_partition_write(reopened, next * JOURNAL_SECTOR + sizeof(JournalHeader), &stale, sizeof(stale)) == ESP_OK;
+  StateJournal* m = new StateJournal();
+  ok &= m->begin(reopened) && m->get_sector() == sector;
+  ok &= m->get(STATE_ANIMATION, value) && value == 10 * JOURNAL_SLOTS - 1;
+
+  // neither does a torn header with its magic but no sequence number
+  uint32_t magic = JOURNAL_MAGIC;
+  ok &= esp_partition_write(reopened, next * JOURNAL_SECTOR + offsetof(JournalHeader, magic),
+                            &magic, sizeof(magic)) == ESP_OK;
+  StateJournal* n = new StateJournal();
+  ok &= n->begin(reopened) && n->get_sector() == sector;
+  ok &= n->get(STATE_ANIMATION, value) && value == 10 * JOURNAL_SLOTS - 1;
+
+  // the next rotation continues the sequence and is found after a remount
+  uint32_t sequence = n->get_sequence();
+  for (uint32_t w = 0; w <= JOURNAL_SLOTS; w++) {
+    n->set(STATE_ANIMATION, w);
+    ok &= n->flush();
+  }
+  StateJournal* o = new StateJournal();
+  ok &= o->begin(reopened) && o->get_sequence() == sequence + 1;
+  ok &= o->get(STATE_ANIMATION, value) && value == JOURNAL_SLOTS;
+
+  // an empty partition is initialized
+  StateJournal* empty = new StateJournal();
+  ok &= empty->begin(host_partition_create("empty", SECTORS * JOURNAL_SECTOR));
+  ok &= !empty->get(STATE_ANIMATION, value);
+
+  delete j;
+  delete k;
+  delete l;
+  delete m;
+  delete n;
+  delete o;
+  delete empty;
+  remove(path);
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_heap
+
+  Run loop() of the sketch (scheduler, inputs, render_frame() with its
+  journal updates, output, timing statistics and console commands) with a
+  click every HEAP_CLICK_FRAMES frames, so every animation is constructed,
+  drawn and left through a transition, twice, and every console command is
+  handled once. Only the frame delays are skipped. Nothing may allocate on
+  the heap, and the scratch arena has to be empty outside of transitions.
+
+  Returns:
+    true                            if the frame loop stays off the heap.
+*/
+#define HEAP_CLICK_FRAMES 200
+
+bool check_heap() {
+  InputScript sweep = {"sweep", 0, 0, true};
+  uint32_t frames = 2 * ANIMATION_COUNT * HEAP_CLICK_FRAMES;
+  release_transition();
+  ANIMATION_TRANSITION = 0;
+  ACTIVE_ANIMATION = 0;
+  next_animation->reset();
+  active_animation->emplace(ACTIVE_ANIMATION);
+
+  bool ok = SCRATCH.get_used() == 0;
+  uint8_t switches = 0;
+  heap_allocations = 0;
+  counting_heap = true;
+  host_skip_delays = true;
+  for (uint32_t f = 0; f < frames; f++) {
+    apply_script(sweep, f, frames);
+    host_set_digital(BTN_R_PIN, f % HEAP_CLICK_FRAMES == 0 ? LOW : HIGH);
+    uint8_t animation = ACTIVE_ANIMATION;
+
+    if (f == HEAP_CLICK_FRAMES / 2)
+      host_serial_input("tsdpr");
+
+    loop();
+
+    switches += ACTIVE_ANIMATION != animation;
+    ok &= ANIMATION_TRANSITION != 0 || SCRATCH.get_used() == 0;
+  }
+  counting_heap = false;
+  host_skip_delays = false;
+  host_set_digital(BTN_R_PIN, HIGH);
+  input_trace.stop();
+
+  ok &= heap_allocations == 0 && switches == 2 * ANIMATION_COUNT;
+  ok &= SCRATCH.get_peak() <= SCRATCH.get_size();
+  printf("heap allocations in %u frames: %u, scratch peak %u of %u bytes\n",
+         frames, heap_allocations.load(), (unsigned) SCRATCH.get_peak(), (unsigned) SCRATCH.get_size());
+  return ok;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_profiler
+
+  Record known durations for two animations, overflow the ring buffer and
+  check the statistics computed from what is left.
+
+  Returns:
+    true                            if the statistics are as expected.
+*/
+bool check_profiler() {
+  static Profiler test_profiler;
+  ProfileStats s;
+  bool ok = !test_profiler.stats(STAGE_DRAW, 0, s);
+
+  // the first samples are overwritten by the ones that follow
+  for (uint16_t i = 0; i < PROFILE_SAMPLES / 2; i++) {
+    test_profiler.record(STAGE_DRAW, 99999, 0);
+  }
+  for (uint32_t i = 1; i <= 100; i++) {
+    test_profiler.record(STAGE_DRAW, i, 0);
+    test_profiler.record(STAGE_SHOW, 3 * SAMPLE_MAX_US, 1);
+  }
+  for (uint16_t i = 0; i < PROFILE_SAMPLES - 200; i++) {
+    test_profiler.record(STAGE_INPUTS, 7, 2);
+  }
+
+  ok &= test_profiler.stats(STAGE_DRAW, 0, s) && s.count == 100 && s.min == 1 &&
+        s.mean == 50 && s.p99 == 99 && s.max == 100;
+  ok &= test_profiler.stats(STAGE_SHOW, 1, s) && s.max == SAMPLE_MAX_US;
+  ok &= test_profiler.stats(STAGE_INPUTS, 2, s) && s.count == PROFILE_SAMPLES - 200;
+  ok &= !test_profiler.stats(STAGE_DRAW, 1, s);
+
+  test_profiler.reset();
+  return ok && !test_profiler.stats(STAGE_INPUTS, 2, s);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  check_channel_sum
+
+  Compare the incrementally tracked channel sum of the framebuffer against
+  a full scan.
+
+  Returns:
+    true                            if both agree.
+*/
+bool check_channel_sum() {
+  uint32_t sum = 0;
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    sum += channelSum(framebuffer.get(i));
+  }
+  return sum == framebuffer.channel_sum();
+}
+
+
+
+/* ========================================================================= */
+/* main */
+
+/* ========================================================================= */
+/* trace replay */
+
+#define GOLDEN_FILE "golden_frames.txt"   // next to the bench binary
+#define GOLDEN_KEYFRAMES 256        // frames between stored whole frames
+#define BENCH_TRACE_SEED 20240601   // seed of the built-in trace
+
+/**----------------------------------------------------------------------------
+  GoldenFrames
+
+  Output of a trace replay: the hash and the channel sums of every frame,
+  and every GOLDEN_KEYFRAMES-th frame as a whole to measure deviations.
+*/
+struct GoldenFrames
+{
+  uint32_t hashes[TRACE_FRAMES];
+  uint32_t sums[TRACE_FRAMES][4];   // R, G, B, W over all pixels
+  PixelBuffer keyframes[TRACE_FRAMES / GOLDEN_KEYFRAMES];
+  uint16_t frames = 0;
+};
+
+
+/**----------------------------------------------------------------------------
+  record_bench_trace
+
+  Record the built-in trace: both potis sweep at different rates, brightness
+  touches 0 a few times, the right button steps through every animation
+  and the left button goes back once.
+*/
+void record_bench_trace() {
+  input_trace.record(BENCH_TRACE_SEED, 0);
+  for (uint16_t f = 0; f < TRACE_FRAMES; f++) {
+    float phase = 2 * PI * f / TRACE_FRAMES;
+    host_set_analog(POTI_B_PIN, (0.5 + 0.5 * sin(3 * phase)) * 4095);
+    host_set_analog(POTI_M_PIN, (0.5 - 0.5 * cos(phase)) * 4095);
+    host_set_digital(BTN_R_PIN, f % 128 >= 100 && f % 128 < 104 ? LOW : HIGH);
+    host_set_digital(BTN_L_PIN, f >= 964 && f < 968 ? LOW : HIGH);
+    update_inputs();
+    input_trace.step();
+  }
+  host_set_digital(BTN_R_PIN, HIGH);
+  host_set_digital(BTN_L_PIN, HIGH);
+}
+
+
+/**----------------------------------------------------------------------------
+  replay_trace
+
+  Replay input_trace with freshly constructed animations, starting from a
+  black framebuffer and no transition, and collect the frames.
+
+  Parameters:
+    GoldenFrames& out               rendered frames
+*/
+void replay_trace(GoldenFrames& out) {
+  input_trace.replay();
+  ACTIVE_ANIMATION = input_trace.get_animation() % ANIMATION_COUNT;
+  next_animation->reset();
+  active_animation->emplace(ACTIVE_ANIMATION);
+  ANIMATION_TRANSITION = 0;
+  release_transition();
+  framebuffer.clear();
+
+  out.frames = 0;
+  while (input_trace.get_mode() == TRACE_REPLAY) {
+    update_inputs();
+    input_trace.step();
+    render_frame();
+    if (out.frames % GOLDEN_KEYFRAMES == 0)
+      out.keyframes[out.frames / GOLDEN_KEYFRAMES] = framebuffer;
+    uint32_t* sums = out.sums[out.frames];
+    sums[0] = sums[1] = sums[2] = sums[3] = 0;
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      PackedColor color = framebuffer.get_packed(i);
+      for (uint8_t c = 0; c < 4; c++) {
+        sums[c] += (color >> (8 * c)) & 0xff;
+      }
+    }
+    out.hashes[out.frames++] = frame_hash(framebuffer);
+  }
+}
+
+
+/**----------------------------------------------------------------------------
+  load_trace
+
+  Load a trace in the format of InputTrace::dump() into input_trace. Lines
+  before the "trace" header are skipped, so a whole console log can be
+  loaded.
+
+  Returns:
+    true                            if a complete trace was read.
+*/
+bool load_trace(FILE* file) {
+  char line[128];
+  uint32_t seed, animation, frames;
+  do {
+    if (!fgets(line, sizeof(line), file))
+      return false;
+  } while (sscanf(line, "trace %u %u %u", &seed, &animation, &frames) != 3);
+
+  input_trace.reset(seed, animation);
+  for (uint32_t f = 0; f < frames; f++) {
+    uint32_t brightness, mod, buttons;
+    TraceFrame frame;
+    if (fscanf(file, "%x %x %x", &brightness, &mod, &buttons) != 3)
+      return false;
+    memcpy(&frame.brightness, &brightness, sizeof(float));
+    memcpy(&frame.mod, &mod, sizeof(float));
+    frame.buttons = buttons;
+    if (!input_trace.add(frame))
+      return false;
+  }
+  return true;
+}
+
+
+/**----------------------------------------------------------------------------
+  write_golden
+
+  Write input_trace and the frames it renders to a golden file: the trace
+  as dumped by the lamp, then "frames <n>" and the hash and channel sums of
+  one frame per line, then
+  "keyframe <f>" and the packed pixels of every keyframe.
+
+  Returns:
+    true                            if the file was written.
+*/
+bool write_golden(const char* path, const GoldenFrames& golden) {
+  FILE* file = fopen(path, "w");
+  if (!file)
+    return false;
+
+  fprintf(file, "trace %u %u %u\n", input_trace.get_seed(), input_trace.get_animation(), input_trace.get_length());
+  for (uint16_t f = 0; f < input_trace.get_length(); f++) {
+    const TraceFrame& frame = input_trace.get_frame(f);
+    uint32_t brightness, mod;
+    memcpy(&brightness, &frame.brightness, sizeof(float));
+    memcpy(&mod, &frame.mod, sizeof(float));
+    fprintf(file, "%08x %08x %x\n", brightness, mod, frame.buttons);
+  }
+
+  fprintf(file, "frames %u\n", golden.frames);
+  for (uint16_t f = 0; f < golden.frames; f++) {
+    const uint32_t* sums = golden.sums[f];
+    fprintf(file, "%08x %x %x %x %x\n", golden.hashes[f], sums[0], sums[1], sums[2], sums[3]);
+  }
+  for (uint16_t f = 0; f < golden.frames; f += GOLDEN_KEYFRAMES) {
+    fprintf(file, "keyframe %u\n", f);
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      fprintf(file, "%08x%c", golden.keyframes[f / GOLDEN_KEYFRAMES].get_packed(i), i % 8 == 7 ? '\n' : ' ');
+    }
+    fprintf(file, "\n");
+  }
+  return fclose(file) == 0;
+}
+
+
+/**----------------------------------------------------------------------------
+  load_golden
+
+  Load a golden file written by write_golden(), the trace into input_trace.
+
+  Returns:
+    true                            if the whole file was read.
+*/
+bool load_golden(const char* path, GoldenFrames& golden) {
+  FILE* file = fopen(path, "r");
+  if (!file)
+    return false;
+
+  bool ok = load_trace(file);
+  uint32_t frames = 0;
+  ok = ok && fscanf(file, " frames %u", &frames) == 1 && frames <= TRACE_FRAMES;
+  golden.frames = frames;
+  for (uint16_t f = 0; ok && f < golden.frames; f++) {
+    uint32_t* sums = golden.sums[f];
+    ok = fscanf(file, "%x %x %x %x %x", &golden.hashes[f], &sums[0], &sums[1], &sums[2], &sums[3]) == 5;
+  }
+  for (uint16_t f = 0; ok && f < golden.frames; f += GOLDEN_KEYFRAMES) {
+    uint32_t keyframe;
+    ok = fscanf(file, " keyframe %u", &keyframe) == 1 && keyframe == f;
+    for (uint16_t i = 0; ok && i < NUM_LEDs; i++) {
+      uint32_t color;
+      ok = fscanf(file, "%x", &color) == 1;
+      golden.keyframes[f / GOLDEN_KEYFRAMES].set_packed(i, color);
+    }
+  }
+  fclose(file);
+  return ok;
+}
+
+
+/**----------------------------------------------------------------------------
+  check_golden
+
+  Replay a trace and compare every frame against golden frames. Frames have
+  to be bit exact, unless a tolerance is given: then differing frames are
+  accepted if no channel of a keyframe deviates more than max_error, and
+  no channel sum of any other frame deviates more than max_error per
+  pixel.
+  Replaying twice has to render the same frames in any case.
+
+  With write set, the golden file is written instead, from the trace in
+  trace_path (dumped by the lamp), or from the built-in trace.
+
+  Parameters:
+    const char* golden_path         golden file
+    const char* trace_path          trace to write golden frames for, or NULL
+    bool write                      write instead of compare
+    uint8_t max_error               tolerated channel deviation, 0 = exact
+
+  Returns:
+    true                            if the frames match.
+*/
+bool check_golden(const char* golden_path, const char* trace_path, bool write, uint8_t max_error) {
+  static GoldenFrames golden, first, second;
+
+  if (write) {
+    FILE* file = trace_path ? fopen(trace_path, "r") : NULL;
+    bool loaded = file && load_trace(file);
+    if (file)
+      fclose(file);
+    if (trace_path && !loaded) {
+      printf("could not load trace %s\n", trace_path);
+      return false;
+    }
+    if (!trace_path)
+      record_bench_trace();
+  } else if (!load_golden(golden_path, golden)) {
+    printf("could not load golden frames %s, write them with -w\n", golden_path);
+    return false;
+  }
+
+  replay_trace(first);
+  replay_trace(second);
+  bool deterministic = first.frames == second.frames &&
+                       memcmp(first.hashes, second.hashes, first.frames * sizeof(uint32_t)) == 0;
+  printf("trace replay deterministic: %s\n", deterministic ? "yes" : "NO");
+
+  if (write) {
+    bool written = write_golden(golden_path, first);
+    printf("golden frames written to %s: %s\n", golden_path, written ? "yes" : "NO");
+    return deterministic && written;
+  }
+
+  uint16_t differing = 0, first_differing = 0;
+  uint32_t sum_deviation = 0;       // largest channel sum deviation
+  for (uint16_t f = 0; f < min(first.frames, golden.frames); f++) {
+    if (first.hashes[f] == golden.hashes[f])
+      continue;
+    if (differing++ == 0)
+      first_differing = f;
+    for (uint8_t c = 0; c < 4; c++) {
+      sum_deviation = max(sum_deviation, (uint32_t) abs((int32_t) first.sums[f][c] - (int32_t) golden.sums[f][c]));
+    }
+  }
+  uint8_t deviation = 0;
+  for (uint16_t k = 0; k * GOLDEN_KEYFRAMES < min(first.frames, golden.frames); k++) {
+    for (uint16_t i = 0; i < NUM_LEDs; i++) {
+      PackedColor a = first.keyframes[k].get_packed(i), b = golden.keyframes[k].get_packed(i);
+      for (uint8_t c = 0; c < 4; c++) {
+        deviation = max(deviation, (uint8_t) abs((int) ((a >> (8 * c)) & 0xff) - (int) ((b >> (8 * c)) & 0xff)));
+      }
+    }
+  }
+
+  bool ok = first.frames == golden.frames &&
+            (differing == 0 ||
+             (max_error > 0 && deviation <= max_error && sum_deviation <= (uint32_t) max_error * NUM_LEDs));
+  printf("frames match golden frames: %s", ok ? "yes" : "NO");
+  if (differing)
+    printf(" (%u of %u frames differ from frame %u, keyframe deviation %u, channel sum deviation %u)",
+           differing, golden.frames, first_differing, deviation, sum_deviation);
+  printf("\n");
+  return deterministic && ok;
+}
+
+
+
+int main(int argc, char** argv) {
+  uint32_t frames = 2000;
+  float max_milliamps = 5000;
+  const char* trace_path = NULL;
+  bool write = false;
+  uint8_t max_error = 0;
+
+  // golden frames are kept next to the binary
+  static char golden_path[512];
+  const char* slash = strrchr(argv[0], '/');
+  snprintf(golden_path, sizeof(golden_path), "%.*s%s",
+           slash ? (int) (slash - argv[0] + 1) : 0, argv[0], GOLDEN_FILE);
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-w") == 0) {
+      write = true;
+    } else if (i == argc - 1) {
+      break;
+    } else if (strcmp(argv[i], "-f") == 0) {
+      frames = atoi(argv[++i]);
+    } else if (strcmp(argv[i], "-m") == 0) {
+      max_milliamps = atof(argv[++i]);
+    } else if (strcmp(argv[i], "-g") == 0) {
+      snprintf(golden_path, sizeof(golden_path), "%s", argv[++i]);
+    } else if (strcmp(argv[i], "-t") == 0) {
+      trace_path = argv[++i];
+    } else if (strcmp(argv[i], "-e") == 0) {
+      max_error = atoi(argv[++i]);
+    }
+  }
+  if (frames == 0)
+    frames = 1;
+
+  Serial.setEcho(false);
+  setup();
+  setMaxMilliamps(max_milliamps > 0 ? max_milliamps : INFINITY);
+
+  printf("frames per run: %u, frame budget: %d ms, current limit: ", frames, FRAME_DELAY);
+  if (max_milliamps > 0)
+    printf("%.0f mA\n\n", max_milliamps);
+  else
+    printf("none\n\n");
+
+  printf("%-11s %-10s %9s %9s %9s %9s %7s %11s %9s %7s\n",
+         "animation", "script", "update", "draw", "show", "frame", "budget",
+         "transition", "t-frame", "budget");
+
+  bool sum_ok = true;
+  for (uint8_t a = 0; a < BENCH_ANIMATION_COUNT; a++) {
+    for (const InputScript& script : SCRIPTS) {
+      StageTimes t = bench_frames(a, script, frames);
+      print_frame_results(BENCH_ANIMATIONS[a], script.name, t);
+      sum_ok &= check_channel_sum();
+    }
+  }
+
+  bench_primitives(frames);
+
+  sum_ok &= check_channel_sum();
+  printf("\nframebuffer channel sum matches: %s\n", sum_ok ? "yes" : "NO");
+
+  bool packed_ok = check_packed();
+  printf("packed color ops match reference: %s\n", packed_ok ? "yes" : "NO");
+
+  bool projections_ok = check_projections();
+  printf("projection bands match full scan: %s\n", projections_ok ? "yes" : "NO");
+
+  bool tables_ok = check_lamp_tables();
+  printf("lamp tables match math library: %s\n", tables_ok ? "yes" : "NO");
+
+  bool topology_ok = check_topology();
+  printf("lamp topology consistent: %s\n", topology_ok ? "yes" : "NO");
+
+  bool walker_ok = check_walker();
+  printf("graph walks valid: %s\n", walker_ok ? "yes" : "NO");
+
+  bool particles_ok = check_particles();
+  printf("particles move, cross and render along the graph: %s\n", particles_ok ? "yes" : "NO");
+
+  bool shaders_ok = check_shaders();
+  printf("fused shaders match separate passes: %s\n", shaders_ok ? "yes" : "NO");
+
+  bool pipeline_ok = check_pipeline(10000);
+  printf("pipelined frames intact and in order: %s\n", pipeline_ok ? "yes" : "NO");
+
+  bool scheduler_ok = check_scheduler();
+  printf("frame scheduler deadlines and statistics: %s\n", scheduler_ok ? "yes" : "NO");
+
+  bool transitions_ok = check_transitions();
+  printf("transitions reveal every pixel and end: %s\n", transitions_ok ? "yes" : "NO");
+
+  bool masked_ok = check_masked_render();
+  printf("masked renders match full renders: %s\n", masked_ok ? "yes" : "NO");
+
+  bool compositor_ok = check_compositor();
+  printf("fused layers match layer by layer blending: %s\n", compositor_ok ? "yes" : "NO");
+
+  bool change_ok = check_change_detection();
+  printf("unchanged frames detected: %s\n", change_ok ? "yes" : "NO");
+
+  bool output_ok = check_output_stage();
+  printf("output stage gamma, dithering and current limit: %s\n", output_ok ? "yes" : "NO");
+
+  bool inputs_ok = check_input_sampler();
+  printf("inputs filtered and snapshots consistent: %s\n", inputs_ok ? "yes" : "NO");
+
+  bool rng_ok = check_rng();
+  printf("random numbers match PCG32 and are unbiased: %s\n", rng_ok ? "yes" : "NO");
+
+  bool journal_ok = check_journal();
+  printf("state journal persists, coalesces and levels wear: %s\n", journal_ok ? "yes" : "NO");
+
+  bool heap_ok = check_heap();
+  printf("frame loop without heap allocations: %s\n", heap_ok ? "yes" : "NO");
+
+  bool profiler_ok = check_profiler();
+  printf("profiler statistics: %s\n", profiler_ok ? "yes" : "NO");
+
+  bool golden_ok = check_golden(golden_path, trace_path, write, max_error);
+
+  uint8_t hsvw_error = check_hsvw();
+  printf("Hsvw2Rgbw max deviation from reference: %u\n", hsvw_error);
+  return sum_ok && packed_ok && projections_ok && tables_ok && topology_ok && walker_ok && particles_ok && shaders_ok && pipeline_ok && scheduler_ok && transitions_ok && masked_ok && compositor_ok && change_ok && output_ok && inputs_ok && rng_ok && journal_ok && heap_ok && profiler_ok && golden_ok && hsvw_error <= 1 ? 0 : 1;
+}
@@ -0,0 +1,160 @@
+/** ===========================================================================
+  esp_partition.h (host stand-in)
+
+  In-process replacement of the ESP-IDF partition API. Partitions are RAM
+  images with NOR flash semantics: erasing sets whole sectors to 0xff and
+  writing can only clear bits, so code that writes without erasing behaves
+  as wrong as it would on the lamp.
+
+  The "journal" partition of the lamp exists from the start. More
+  partitions can be created from the host side, optionally backed by a
+  file, so their contents survive a simulated reboot:
+    host_partition_create(label, size, path)
+    host_partition_erases(partition, sector)  erase count of a sector
+*/
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <vector>
+
+typedef int esp_err_t;
+
+#define ESP_OK                  0
+#define ESP_FAIL                -1
+#define ESP_ERR_INVALID_ARG     0x102
+#define ESP_ERR_INVALID_SIZE    0x104
+
+#define SPI_FLASH_SEC_SIZE      4096
+
+typedef enum {
+  ESP_PARTITION_TYPE_APP = 0x00,
+  ESP_PARTITION_TYPE_DATA = 0x01
+} esp_partition_type_t;
+
+typedef enum {
+  ESP_PARTITION_SUBTYPE_ANY = 0xff
+} esp_partition_subtype_t;
+
+struct esp_partition_t
+{
+  esp_partition_type_t type;
+  uint8_t subtype;
+  uint32_t address;
+  uint32_t size;
+  char label[17];
+  bool encrypted;
+
+  /* host only */
+  std::vector<uint8_t> data;        // flash contents
+  std::vector<uint32_t> erases;     // erase count per sector
+  const char* path;                 // backing file, NULL for RAM only
+};
+
+
+/* ========================================================================= */
+/* host side */
+
+inline std::vector<esp_partition_t*> host_partitions;
+
+/* write a range of a partition through to its backing file */
+inline void host_partition_sync(const esp_partition_t* partition, size_t offset, size_t size) {
+  if (!partition->path)
+    return;
+  FILE* file = fopen(partition->path, "r+b");
+  if (!file)
+    file = fopen(partition->path, "w+b");
+  if (!file)
+    return;
+  fseek(file, offset, SEEK_SET);
+  fwrite(partition->data.data() + offset, 1, size, file);
+  fclose(file);
+}
+
+/**----------------------------------------------------------------------------
+  host_partition_create
+
+  Create a data partition. With a path, the contents are loaded from that
+  file if it exists and every change is written through to it.
+*/
+inline esp_partition_t* host_partition_create(const char* label, uint32_t size, const char* path = NULL) {
+  esp_partition_t* partition = new esp_partition_t();
+  partition->type = ESP_PARTITION_TYPE_DATA;
+  partition->subtype = 0x40;
+  partition->size = size;
+  snprintf(partition->label, sizeof(partition->label), "%s", label);
+  partition->data.assign(size, 0xff);
+  partition->erases.assign(size / SPI_FLASH_SEC_SIZE, 0);
+  partition->path = path;
+
+  FILE* file = path ? fopen(path, "rb") : NULL;
+  if (file) {
+    size_t read = fread(partition->data.data(), 1, size, file);
+    (void) read;
+    fclose(file);
+  } else {
+    host_partition_sync(partition, 0, size);
+  }
+  host_partitions.push_back(partition);
+  return partition;
+}
+
+/* erase count of a sector */
+inline uint32_t host_partition_erases(const esp_partition_t* partition, uint32_t sector) {
+  return sector < partition->erases.size() ? partition->erases[sector] : 0;
+}
+
+/* the journal partition of the lamp, see led_control/partitions.csv */
+inline esp_partition_t* host_journal_partition = host_partition_create("journal", 0x4000);
+
+
+/* ========================================================================= */
+/* partition API */
+
+inline const esp_partition_t* esp_partition_find_first(esp_partition_type_t type,
+                                                       esp_partition_subtype_t subtype,
+                                                       const char* label) {
+  for (const esp_partition_t* partition : host_partitions) {
+    if (partition->type == type &&
+        (subtype == ESP_PARTITION_SUBTYPE_ANY || partition->subtype == subtype) &&
+        (!label || strcmp(partition->label, label) == 0))
+      return partition;
+  }
+  return NULL;
+}
+
+inline esp_err_t esp_partition_read(const esp_partition_t* partition, size_t offset, void* dst, size_t size) {
+  if (!partition || offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  memcpy(dst, partition->data.data() + offset, size);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_write(const esp_partition_t* partition, size_t offset, const void* src, size_t size) {
+  if (!partition || offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  esp_partition_t* p = const_cast<esp_partition_t*>(partition);
+  const uint8_t* bytes = (const uint8_t*) src;
+  for (size_t i = 0; i < size; i++) {
+    p->data[offset + i] &= bytes[i];  // NOR flash only clears bits
+  }
+  host_partition_sync(p, offset, size);
+  return ESP_OK;
+}
+
+inline esp_err_t esp_partition_erase_range(const esp_partition_t* partition, size_t offset, size_t size) {
+  if (!partition || offset + size > partition->size)
+    return ESP_ERR_INVALID_SIZE;
+  if (offset % SPI_FLASH_SEC_SIZE || size % SPI_FLASH_SEC_SIZE)
+    return ESP_ERR_INVALID_ARG;
+  esp_partition_t* p = const_cast<esp_partition_t*>(partition);
+  memset(p->data.data() + offset, 0xff, size);
+  for (size_t s = offset / SPI_FLASH_SEC_SIZE; s < (offset + size) / SPI_FLASH_SEC_SIZE; s++) {
+    p->erases[s]++;
+  }
+  host_partition_sync(p, offset, size);
+  return ESP_OK;
+}
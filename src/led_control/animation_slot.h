@@ -0,0 +1,130 @@
+/** ===========================================================================
+  animation_slot.h
+
+  This file contains the AnimationSlot, which holds at most one animation
+  out of a list of animation types known at compile time. The list is the
+  registry of all animations of the lamp, in switching order (see
+  led_control.ino).
+
+  A slot is as large as the largest animation and lives in static memory.
+  Animations are constructed when they are needed and destroyed when they
+  are left, so only the active animation and the target of a transition
+  exist at any time, and nothing is constructed for animations that are
+  never shown.
+
+  Calls through a slot select the animation type by its index once, the
+  call itself is a direct call of the concrete type, so update() and
+  render() of every animation can be inlined.
+*/
+
+#pragma once
+
+#include <utility>
+#include <variant>
+
+#include "animations.h"
+
+#define NO_ANIMATION 0xff           // index of an empty slot
+
+/** -----------------------------------------------------------------
+  AnimationSlot
+
+  Storage for one animation out of ANIMATIONS, all derived from Animation.
+  Calls on an empty slot do nothing.
+*/
+template<class... ANIMATIONS>
+class AnimationSlot
+{
+  public:
+    static constexpr uint8_t COUNT = sizeof...(ANIMATIONS);
+
+  private:
+    std::variant<std::monostate, ANIMATIONS...> _animation;
+
+    /* call function with the animation if it is the I-th type */
+    template<class FUNCTION, size_t... I>
+    inline void _dispatch(FUNCTION&& function, std::index_sequence<I...>)
+    {
+      size_t index = _animation.index();
+      ((index == I + 1 ? function(*std::get_if<I + 1>(&_animation)) : void()), ...);
+    }
+
+    template<class FUNCTION, size_t... I>
+    inline void _dispatch(FUNCTION&& function, std::index_sequence<I...>) const
+    {
+      size_t index = _animation.index();
+      ((index == I + 1 ? function(*std::get_if<I + 1>(&_animation)) : void()), ...);
+    }
+
+    template<class FUNCTION>
+    inline void _dispatch(FUNCTION&& function)
+    {
+      _dispatch(function, std::index_sequence_for<ANIMATIONS...>());
+    }
+
+    template<class FUNCTION>
+    inline void _dispatch(FUNCTION&& function) const
+    {
+      _dispatch(function, std::index_sequence_for<ANIMATIONS...>());
+    }
+
+    /* construct the I-th animation in place */
+    template<size_t I>
+    static void _construct(AnimationSlot& slot)
+    {
+      slot._animation.template emplace<I + 1>();
+    }
+
+    template<size_t... I>
+    void _emplace(uint8_t index, std::index_sequence<I...>)
+    {
+      static void (* const constructors[])(AnimationSlot&) = {&_construct<I>...};
+      constructors[index](*this);
+    }
+
+  public:
+    /**
+      emplace
+
+      Construct an animation, destroying the one held before. Animations
+      draw their random seeds here.
+
+      Parameters:
+        uint8_t index               index of the animation in ANIMATIONS
+    */
+    void emplace(uint8_t index)
+    {
+      if (index >= COUNT)
+        return;
+      reset();
+      _emplace(index, std::index_sequence_for<ANIMATIONS...>());
+    }
+
+    /* destroy the animation */
+    void reset() { _animation.template emplace<0>(); }
+
+    /* index of the animation in ANIMATIONS, NO_ANIMATION if empty */
+    uint8_t index() const { return _animation.index() - 1; }
+
+    /* forwarded to the animation, see Animation */
+    void update() { _dispatch([](auto& animation) { animation.update(); }); }
+    void draw() { _dispatch([](auto& animation) { animation.draw(); }); }
+    void invalidate() { _dispatch([](auto& animation) { animation.invalidate(); }); }
+
+    void render(PixelBuffer& target)
+    {
+      _dispatch([&](auto& animation) { animation.render(target); });
+    }
+
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
+    {
+      _dispatch([&](auto& animation) { animation.render_masked(target, mask, scratch); });
+    }
+
+    bool needs_draw() const
+    {
+      bool needs = false;
+      _dispatch([&](const auto& animation) { needs = animation.needs_draw(); });
+      return needs;
+    }
+};
@@ -3,61 +3,152 @@
   animations.h
 
   This file handles all animations.
-  Animations implement the (pure) virtual functions of the Animation class.
-  This includes an update function, a draw function and optionally a getState
-  function, which writes the current animation state to a given buffer.
+  Animations derive from the Animation class template with themselves as
+  parameter and implement its update and render functions, the latter
+  writes the current animation state to a given PixelBuffer. There are no
+  virtual calls, so per-pixel code can be inlined into the loops calling it
+  (see animation_slot.h for how the sketch picks an animation at runtime). Drawing to the led strip is
+  just rendering into the framebuffer, so offscreen buffers (e.g. during
+  transitions) and the strip share the exact same code path.
+  Animations render at full brightness, BRIGHTNESS is applied on the way to
+  the strip (see output_stage.h).
+  Animations whose pixels do not depend on each other can also render only
+  the pixels of a PixelMask (see render_masked()).
 */
 
 #pragma once
 
-#include <vector>
 #include <tuple>
 
 #include "led_functions.h"
 #include "utils.h"
 #include "pixels.h"
+#include "graph_walk.h"
+#include "particles.h"
+#include "shader.h"
+#include "transitions.h"
+#include "state_journal.h"
+#include "arena.h"
 
 using namespace std;
 
-/* lamp variables */
-extern Pixel lamp[];
-extern uint16_t lamp_x, lamp_y;
-
 /* I/O variables */
 extern float BRIGHTNESS, MOD;
 extern bool LEFT_BUTTON, RIGHT_BUTTON;
+extern uint8_t BUTTON_CLICKS;
 
 /* animation variables */
 extern uint8_t ACTIVE_ANIMATION;
 extern uint8_t ANIMATION_COUNT;
 extern int8_t ANIMATION_TRANSITION;
 
+/* largest scratch memory of a render call, see ParticleSystem::render() */
+#define FRAME_SCRATCH (NUM_LEDs * (sizeof(HsvColor) + sizeof(RgbwColor)) + 2 * ARENA_ALIGN)
+
 
 /* ========================================================================= */
 /* helper classes */
 
+/* inputs an animation depends on, can be combined */
+#define DEPENDS_BRIGHTNESS  0x01    // BRIGHTNESS
+#define DEPENDS_MOD         0x02    // MOD
+#define DEPENDS_TIME        0x04    // changes from frame to frame on its own
+
+#define INPUT_STATE_NONE    0xffffffffu   // no input state recorded
+
+/**----------------------------------------------------------------------------
+  input_state
+
+  Quantized state of the given inputs. BRIGHTNESS is quantized to 8 bits,
+  MOD to 10 bits, which is finer than any animation maps it to colors or
+  hues. Noise below that does not count as a change.
+
+  Parameters:
+    uint8_t dependencies            combination of DEPENDS_* flags
+
+  Returns:
+    uint32_t                        state, equal states render equal frames
+*/
+inline uint32_t input_state(uint8_t dependencies) {
+  uint32_t state = 0;
+  if (dependencies & DEPENDS_BRIGHTNESS)
+    state |= unit_to_u8(BRIGHTNESS);
+  if (dependencies & DEPENDS_MOD)
+    state |= (uint32_t) (constrain(MOD, 0, 1) * 1023) << 8;
+  return state;
+}
+
+
 /** -----------------------------------------------------------------
   Animation
 
-  This interface class functions as a building block for animations.
-  It provides pure virtual functions to update and draw the animation that have
-  to be implemented for each animaiton accordingly. Additionally it provides
-  an optional function to write the current animation state to a buffer.
+  This class template functions as a building block for animations.
+  Every animation ANIMATION derives from Animation<ANIMATION> and has to
+  implement
+    void update()                   update inner params
+    void render(PixelBuffer&)       render current state into target
+  Animations that only depend on some inputs hide get_dependencies() with
+  their own, so they are not drawn again while those inputs stay the same.
+  render_masked() can be hidden the same way.
  */
+template<class ANIMATION>
 class Animation
 {
+  private:
+    uint32_t _drawn_state = INPUT_STATE_NONE;  // input state of the last draw()
+
+    ANIMATION& _self() { return static_cast<ANIMATION&>(*this); }
+    const ANIMATION& _self() const { return static_cast<const ANIMATION&>(*this); }
+
+  protected:
+    Rng _rng = Rng(RNG.next());     // own random numbers, seeded from RNG
+
   public:
-    /* update inner params */
-    virtual void update() = 0;
-    /* draw state to led strip */
-    virtual void draw() = 0;
-    /* get the current state as RgbwColor array of size NUM_LEDs */
-    virtual void getState(RgbwColor* buffer) { }
-};
+    /* inputs the rendered frame depends on, DEPENDS_* flags */
+    uint8_t get_dependencies() const { return DEPENDS_TIME; }
+
+    /* draw current state to framebuffer */
+    void draw()
+    {
+      _self().render(framebuffer);
+      _drawn_state = input_state(_self().get_dependencies());
+    }
 
-// TODO: merge draw() and getState(buffer) into draw(buffer) with NULL-check on buffer
-// NOTE: MAY result in funny behavior on transition change if not implemented
-// ALTERNATIVE: add apply_color(buffer) function with NULL-check-logic (maybe inline?)
+    /* true if draw() would render a different frame than last time */
+    bool needs_draw() const
+    {
+      uint8_t dependencies = _self().get_dependencies();
+      return (dependencies & DEPENDS_TIME) || input_state(dependencies) != _drawn_state;
+    }
+
+    /* draw again next time, e.g. after something else was drawn */
+    void invalidate() { _drawn_state = INPUT_STATE_NONE; }
+
+    /**
+      render_masked
+
+      Render the current state into the pixels of a mask only, all other
+      pixels of target are left untouched.
+      By default, everything is rendered into scratch and the masked pixels
+      are copied over. Animations that build on their last frame need the
+      same scratch buffer every frame. If scratch is target, nothing has to
+      be copied.
+
+      Parameters:
+        PixelBuffer& target         buffer to render into
+        const PixelMask& mask       pixels to render
+        PixelBuffer& scratch        buffer for full renders
+    */
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
+    {
+      _self().render(scratch);
+      if (&scratch == &target)
+        return;
+      mask.for_each([&](uint16_t pixel) {
+        target.set_packed(pixel, scratch.get_packed(pixel));
+      });
+    }
+};
 
 /* ========================================================================= */
 /* animations */
@@ -68,7 +159,7 @@ class Animation
   Plain white scene.
   Can be modified to change brightness and color temperature.
 */
-class PlainWhite : public Animation
+class PlainWhite : public Animation<PlainWhite>
 {
   private:
     float _ratio = 0.9;             // filter ratio
@@ -87,7 +178,7 @@ class PlainWhite : public Animation
           _c[1] * (1 - ratio) + _n[1] * ratio,
           _c[2] * (1 - ratio) + _n[2] * ratio,
           _c[3] * (1 - ratio) + _n[3] * ratio
-        ).Dim(BRIGHTNESS * 255);
+        );
       } else if (MOD > 0.5 + _neutral_deadband) {
         //warm
         float ratio = (1 - MOD) / (0.5 - _neutral_deadband);
@@ -96,7 +187,7 @@ class PlainWhite : public Animation
           _w[1] * (1 - ratio) + _n[1] * ratio,
           _w[2] * (1 - ratio) + _n[2] * ratio,
           _w[3] * (1 - ratio) + _n[3] * ratio
-        ).Dim(BRIGHTNESS * 255);
+        );
       } else {
         // neutral
         return RgbwColor(
@@ -104,32 +195,27 @@ class PlainWhite : public Animation
           _n[1], 
           _n[2], 
           _n[3]
-        ).Dim(BRIGHTNESS * 255);
+        );
       }
     }
   
   public:
-    PlainWhite()
-    {
-      update();
-      draw();
-    };
+    PlainWhite() {}
 
     /* update current state */
-    void update() override {}
+    void update() {}
 
-    /* draw current state to led strip */
-    void draw() override
+    uint8_t get_dependencies() const { return DEPENDS_MOD; }
+
+    /* render current state */
+    void render(PixelBuffer& target)
     {
-      setSolid(0, NUM_LEDs, _get_color());
+      setSolid(_get_color(), target);
     }
 
-    void getState(RgbwColor* buffer) override
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
     {
-      RgbwColor color = _get_color();
-      for (uint16_t i = 0; i < NUM_LEDs; i++) {
-        buffer[i] = color;
-      }
+      setMasked(mask, _get_color(), target);
     }
 };
 
@@ -140,26 +226,26 @@ class PlainWhite : public Animation
 
   Visualisation of the HSV color space. Saturation is set to 1.
 
-  BRIGHTNESS controls value
+  BRIGHTNESS controls brightness
   MOD controls hue
 */
-class HueLight : public Animation
+class HueLight : public Animation<HueLight>
 {
   public:
     HueLight() {}
 
-    void update() override {}
+    void update() {}
+
+    uint8_t get_dependencies() const { return DEPENDS_MOD; }
 
-    void draw() override
+    void render(PixelBuffer& target)
     {
-      setSolid(Hsvw2Rgbw(MOD * 360, 1, BRIGHTNESS, 0));
+      setSolid(Hsvw2Rgbw(MOD * 360, 1, 1, 0), target);
     }
 
-    void getState(RgbwColor* buffer) override
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
     {
-      for (int i = 0; i < NUM_LEDs; i++) {
-        buffer[i] = Hsvw2Rgbw(MOD * 360, 1, BRIGHTNESS, 0);
-      }
+      setMasked(mask, Hsvw2Rgbw(MOD * 360, 1, 1, 0), target);
     }
 };
 
@@ -173,7 +259,7 @@ class HueLight : public Animation
   BRIGHTNESS controls brightness
   MOD controls speed
 */
-class DiagBars : public Animation
+class DiagBars : public Animation<DiagBars>
 {
   private:
     int _x, _x_dir, _dx;
@@ -181,30 +267,42 @@ class DiagBars : public Animation
     float _hue_x, _sat_x, _hue_y, _sat_y;
     int _speed;
 
+    /* add a bar along a projection, fading out towards its edges */
+    void _add_bar(const Projection& proj, int8_t x_fac, int8_t y_fac, int pos, int width,
+                  float hue, float sat, PixelBuffer& target)
+    {
+      using namespace shader;
+      addShader(
+        proj.band(pos, width),
+        hue_map(hue_to_fixed(hue), unit_to_u8(sat), band(coord_linear(x_fac, y_fac), pos, width)),
+        target
+      );
+    }
+
   public:
     DiagBars() :
-      _x(random(lamp_x)),
+      _x(_rng.below(lamp_x)),
       _x_dir(1),
       _dx(50),
-      _y(random(lamp_x)),
+      _y(_rng.below(lamp_x)),
       _y_dir(1),
       _dy(50),
-      _hue_x(random(360)),
-      _sat_x((random(50)/50.0) + 25),
-      _hue_y(random(360)),
-      _sat_y((random(50)/50.0) + 25),
-      _speed(analogRead(POTI_M_PIN) / 4096.0 * 20)
+      _hue_x(_rng.below(360)),
+      _sat_x((_rng.below(50)/50.0) + 25),
+      _hue_y(_rng.below(360)),
+      _sat_y((_rng.below(50)/50.0) + 25),
+      _speed(MOD * 20)
     { }
 
-    void update() override
+    void update()
     {
-      _speed = analogRead(POTI_M_PIN) / 4096.0 * 20;
+      _speed = MOD * 20;
 
       if (_x >= lamp_x + lamp_y || _x < 0) {
         _x_dir *= -1;
         _x += _speed * _x_dir;
-        _hue_x = random(360);
-        _sat_x = (random(50)/50.0) + 25;
+        _hue_x = _rng.below(360);
+        _sat_x = (_rng.below(50)/50.0) + 25;
       }
       _x += _speed * _x_dir;
       _hue_x += 0.5;
@@ -215,8 +313,8 @@ class DiagBars : public Animation
       if (_y >= lamp_x || _y < -lamp_y) {
         _y_dir *= -1;
         _y += _speed * 1.1 * _y_dir;
-        _hue_y = random(360);
-        _sat_y = (random(50)/50.0) + 25;
+        _hue_y = _rng.below(360);
+        _sat_y = (_rng.below(50)/50.0) + 25;
       }
       _y += _speed * 1.1 * _y_dir;
       _hue_y += 0.5;
@@ -225,53 +323,17 @@ class DiagBars : public Animation
       }
     }
 
-    void draw() override
-    {
-      fadeToBlackBy(10);
-      float dist;
-      float wave_fac;
-      for (int i = 0; i < NUM_LEDs; i++) {
-        // first bar
-        dist = abs((lamp[i].x + lamp[i].y) - _x);
-        if (dist < _dx) {
-          wave_fac = 1 - (dist / _dx);
-          addPixel(i, Hsvw2Rgbw(_hue_x, _sat_x, BRIGHTNESS * wave_fac, 0));
-        }
-        // second bar
-        dist = abs((lamp[i].x - lamp[i].y) - _y);
-        if (dist < _dy) {
-          wave_fac = 1 - (dist / _dy);
-          addPixel(i, Hsvw2Rgbw(_hue_y, _sat_y, BRIGHTNESS * wave_fac, 0));
-        }
-      }
-    }
-
-    void getState(RgbwColor* buffer)
+    void render(PixelBuffer& target)
     {
-      // load current state into buffer
-      fadeToBlackBy(10, buffer);
-      for (int i = 0; i < NUM_LEDs; i++) {
-        if (abs((lamp[i].x + lamp[i].y) - _x) < _dx) {
-          RgbwColor col = Hsvw2Rgbw(_hue_x, 1, BRIGHTNESS, 0);
-          buffer[i].R = min(buffer[i].R + col.R, 255);
-          buffer[i].G = min(buffer[i].G + col.G, 255);
-          buffer[i].B = min(buffer[i].B + col.B, 255);
-          buffer[i].W = min(buffer[i].W + col.W, 255);
-        }
-        if (abs((lamp[i].x - lamp[i].y) - _y) < _dy) {
-          RgbwColor col = Hsvw2Rgbw(_hue_y, 1, BRIGHTNESS, 0);
-          buffer[i].R = min(buffer[i].R + col.R, 255);
-          buffer[i].G = min(buffer[i].G + col.G, 255);
-          buffer[i].B = min(buffer[i].B + col.B, 255);
-          buffer[i].W = min(buffer[i].W + col.W, 255);
-        }
-      }
+      fadeToBlackBy(10, target);
+      _add_bar(PROJ_SUM, 1, 1, _x, _dx, _hue_x, _sat_x, target);
+      _add_bar(PROJ_DIFF, 1, -1, _y, _dy, _hue_y, _sat_y, target);
     }
 };
 
 
 
-class EdgeColors : public Animation
+class EdgeColors : public Animation<EdgeColors>
 {
   private:
     uint16_t _transition_steps;
@@ -281,21 +343,22 @@ class EdgeColors : public Animation
     RgbwColor _edge_colors[4]; // 0: 0,0; 1: x,0; 2: x,y; 3: 0,y
     // 0 base, 1,2,3 diffs to 0 (over-/underflow considered!)
     bool experimantal_mode = false;
+    bool _last_brightness_zero = false;
 
   public:
     EdgeColors() :
       _transition_steps(MOD * 1000),     // 0 - 25s
       _transition_progress(0),
       _transitioning(0),
-      _dst_color(random_hsvw_color())
+      _dst_color(random_hsvw_color(_rng))
     {
-      for (RgbwColor c : _edge_colors) {
-        c = random_hsvw_color();
+      for (RgbwColor& c : _edge_colors) {
+        c = random_hsvw_color(_rng);
       }
       _start_color = _edge_colors[_transitioning];
     }
 
-    void update() override
+    void update()
     {
       _transition_progress++;
       float fac = min((float) _transition_progress / _transition_steps, 1.0f);
@@ -315,233 +378,272 @@ class EdgeColors : public Animation
         _transitioning = ++_transitioning % 4;
 
         _start_color = _edge_colors[_transitioning];
-        _dst_color = random_hsvw_color();
+        _dst_color = random_hsvw_color(_rng);
       }
 
       // experimental mode
-      static bool last_brightness_zero = false;
       static float experimental_threshold = 0.01;
 
-      if (!last_brightness_zero && BRIGHTNESS <= experimental_threshold) {
+      if (!_last_brightness_zero && BRIGHTNESS <= experimental_threshold) {
         experimantal_mode = !experimantal_mode;
       }
-      last_brightness_zero = BRIGHTNESS <= experimental_threshold;
+      _last_brightness_zero = BRIGHTNESS <= experimental_threshold;
 
       _transition_steps = MOD * 1000;
 
     }
 
-    void calculate_colors(RgbwColor* buffer) {
-      float fac;
-      uint8_t r, g, b, w;           // result colors
-      uint8_t r_1, g_1, b_1, w_1;   // x interpolation y = 0
-      uint8_t r_2, g_2, b_2, w_2;   // x interpolation y = 1
-      for (int i = 0; i < NUM_LEDs; i++) {
-        // bilinear interpolation
-        // x interpolation
-        fac = (float) lamp[i].x / lamp_x;
-        r_1 = (1 - fac) * _edge_colors[0].R + fac * _edge_colors[1].R;
-        g_1 = (1 - fac) * _edge_colors[0].G + fac * _edge_colors[1].G;
-        b_1 = (1 - fac) * _edge_colors[0].B + fac * _edge_colors[1].B;
-        w_1 = (1 - fac) * _edge_colors[0].W + fac * _edge_colors[1].W;
-        r_2 = (1 - fac) * _edge_colors[3].R + fac * _edge_colors[2].R;
-        g_2 = (1 - fac) * _edge_colors[3].G + fac * _edge_colors[2].G;
-        b_2 = (1 - fac) * _edge_colors[3].B + fac * _edge_colors[2].B;
-        w_2 = (1 - fac) * _edge_colors[3].W + fac * _edge_colors[2].W;
-        // y interpolation
-        fac = (float) lamp[i].y / lamp_y;
-        r = ((1 - fac) * r_1 + fac * r_2);// * BRIGHTNESS;
-        g = ((1 - fac) * g_1 + fac * g_2);// * BRIGHTNESS;
-        b = ((1 - fac) * b_1 + fac * b_2);// * BRIGHTNESS;
-        w = ((1 - fac) * w_1 + fac * w_2);// * BRIGHTNESS;
-
-        // experimantal segmentation-look
-        if (experimantal_mode) {
-          uint8_t trsh = 150;
-          if (r < trsh && g < trsh && b < trsh) {
-            r = 0;
-            g = 0;
-            b = 0;
-          } else if (r > g && r > b) {
-            // r max
-            r = 255 * BRIGHTNESS;
-            g = 0;
-            b = 0;
-          } else if (g > b) {
-            // g max
-            r = 0;
-            g = 255 * BRIGHTNESS;
-            b = 0;
-          } else {
-            // b max
-            r = 0;
-            g = 0;
-            b = 255 * BRIGHTNESS;
-          }
-        } else {
-          r *= BRIGHTNESS;
-          g *= BRIGHTNESS;
-          b *= BRIGHTNESS;
-        }
-
-        if (buffer == NULL) {
-          setPixel(i, RgbwColor(r, g, b, w));
-        } else {
-          buffer[i] = RgbwColor(r, g, b, w);
-        }
+    /* experimantal segmentation-look, keeps only the strongest channel */
+    static inline PackedColor _segment(PackedColor color)
+    {
+      uint8_t trsh = 150;
+      uint8_t r = color, g = color >> 8, b = color >> 16;
+      PackedColor w = color & 0xff000000u;
+      if (r < trsh && g < trsh && b < trsh) {
+        return w;
+      } else if (r > g && r > b) {
+        // r max
+        return w | 0x0000ffu;
+      } else if (g > b) {
+        // g max
+        return w | 0x00ff00u;
+      } else {
+        // b max
+        return w | 0xff0000u;
       }
     }
 
-    void draw() override
+    /* bilinear interpolation between the corner colors */
+    inline auto _kernel() const
     {
-      calculate_colors(NULL);
+      using namespace shader;
+      return gradient(
+        gradient(_edge_colors[0], _edge_colors[1], coord_u()),
+        gradient(_edge_colors[3], _edge_colors[2], coord_u()),
+        coord_v()
+      );
     }
 
-    void getState(RgbwColor* buffer) override
+    void render(PixelBuffer& target)
     {
-      calculate_colors(buffer);
+      if (experimantal_mode)
+        setShader(shader::map(_kernel(), _segment), target);
+      else
+        setShader(_kernel(), target);
+    }
+
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
+    {
+      if (experimantal_mode)
+        setShaderMasked(mask, shader::map(_kernel(), _segment), target);
+      else
+        setShaderMasked(mask, _kernel(), target);
     }
 };
 
 
 
-// TODO: Fix
 /** -----------------------------------------------------------------
-  MarchEdges
+  EdgeMarcher
 
-  March along the edges
-
-  BRIGHTNESS controls brightness
-  MOD controls speed
+  Single marcher of MarchEdges. It grows along its edge and then shrinks
+  towards the far vertex, where it continues onto an adjacent edge.
 */
-class EdgeMarcher : public Animation
+class EdgeMarcher
 {
-    
   private:
-    uint8_t _current_edge;          // currently active edge
-    bool _direction;                // true: going up, false: down
-    float _progress, _progress_step;    // progress vars
-    bool _stationary;               // currently animating or waiting
+    EdgeWalker _walker;             // position on the lamp graph
+    float _progress;                // progress on current edge: [0,1]
 
   public:
-    EdgeMarcher() : 
-      _current_edge(random(ARRAY_SIZE(E))),
-      _direction((bool) random(2)),
-      _progress(0),
-      _progress_step(0.025),
-      _stationary(false)
+    EdgeMarcher() :
+      _walker(0, true),
+      _progress(0)
     {}
 
-    void update() override
+    /* start somewhere on a random edge */
+    void begin(Rng& rng)
     {
-      _progress = min(_progress + _progress_step, 1.0f);
-      _stationary = _progress >= 1.0;
+      _walker = EdgeWalker(rng);
+      _progress = rng.below(100) / 100.0;
     }
 
-    void draw() override
+    void update(float progress_step, Rng& rng)
     {
-      // clear current edge
-      // setSolid(E[_current_edge].get_start(), E[_current_edge].get_end() + 1, RgbwColor(0));
-
-      if (!_stationary) {
-        // ongoing transition  
-        float start, end;
-        if(_progress < 0.5) {
-          // growing
-          start = E[_current_edge].get_start();
-          end = start + 2 * _progress * E[_current_edge].get_length();
-        } else {
-          // shrinking
-          start = E[_current_edge].get_start() + (2 * (_progress - 0.5)) * E[_current_edge].get_length();
-          end = E[_current_edge].get_end() + 1;
-        }
-        if (!_direction) {
-          // reverse direction
-          uint16_t offset = E[_current_edge].get_end() + E[_current_edge].get_start();
-          start = offset - start;
-          end   = offset - end;
-        }
-        addFloat(start, end, RgbwColor(100));
-      } else {
-        // done transitioning
-        _current_edge = random(ARRAY_SIZE(E));
-
-        // get random new edge
-        // uint8_t end_vert_index = (uint8_t) get_vertex_index_of(_direction ? E[_current_edge].get_end() : E[_current_edge].get_start());
-        // vector<uint8_t> adjacent_edges = V[end_vert_index].get_edges();
-        // uint8_t next_edge_index = random(adjacent_edges.size());
-        // _current_edge = adjacent_edges[next_edge_index];
-        // _direction = E[_current_edge].get_start() == V[end_vert_index].get_indices()[next_edge_index];
-
-
+      _progress += progress_step;
+      if (_progress >= 1.0) {
+        // continue at the end vertex
         _progress = 0;
-        _stationary = false;
+        _walker.advance(rng, WALK_NO_BACKTRACK);
       }
     }
 
-    void getState(RgbwColor* buffer)
+    void render(PixelBuffer& target, RgbwColor color)
     {
-      if (!_stationary) {
-        // ongoing transition
-        clear_strip();
-        float start, end;
-        if(_progress < 0.5) {
-          // growing
-          start = E[_current_edge].get_start();
-          end = 2 * _progress * E[_current_edge].get_length();
-        } else {
-          // shrinking
-          start = 1 - (2 * _progress) * E[_current_edge].get_length();
-          end = E[_current_edge].get_end() + 1;
-        }
-        for (uint8_t i = start; i < end; i++) {
-          addPixel(i, RgbwColor(100));
-        }
-        // addFloat(start, end, RgbwColor(100));
-        Serial.printf("start: %f, end: %f\n", start, end);
+      const Edge& edge = E[_walker.get_edge()];
+      float length = edge.get_length() + 1;
+
+      // covered part of the edge in walking direction
+      float tail = _progress < 0.5 ? 0 : (2 * _progress - 1) * length;
+      float head = _progress < 0.5 ? 2 * _progress * length : length;
+
+      if (_walker.is_forward()) {
+        addFloat(edge.get_start() + tail, edge.get_start() + head, color, target);
       } else {
-        Serial.println("BLAH");
-        // done transitioning
-        _current_edge = random(ARRAY_SIZE(E));
-        _progress = 0;
-        _stationary = false;
+        addFloat(edge.get_end() + 1 - head, edge.get_end() + 1 - tail, color, target);
       }
     }
 };
 
-class MarchEdges : public Animation
+
+
+/** -----------------------------------------------------------------
+  MarchEdges
+
+  March along the edges. Every marcher walks the lamp graph on its own and
+  never turns back on the edge it came from.
+
+  BRIGHTNESS controls brightness
+  MOD controls speed
+*/
+#define MAX_MARCHERS 64
+
+class MarchEdges : public Animation<MarchEdges>
 {
   private:
-    vector<EdgeMarcher*> _marchers;
+    EdgeMarcher _marchers[MAX_MARCHERS];
     uint8_t _count;
-  
+
   public:
-    MarchEdges(uint8_t marcher_amount = 3) :
-      _count(marcher_amount)
+    MarchEdges(uint8_t marcher_amount = 24) :
+      _count(min(marcher_amount, (uint8_t) MAX_MARCHERS))
     {
       for (uint8_t i = 0; i < _count; i++) {
-        _marchers.push_back(new EdgeMarcher());
+        _marchers[i].begin(_rng);
       }
     }
 
-    void update() override
+    void update()
     {
+      float step = 0.005 + 0.05 * MOD;
       for (uint8_t i = 0; i < _count; i++) {
-        _marchers[i]->update();
+        _marchers[i].update(step, _rng);
       }
     }
 
-    void draw() override
+    void render(PixelBuffer& target)
     {
-      clear_strip();
+      RgbwColor color = RgbwColor(255);
+      clear_strip(target);
       for (uint8_t i = 0; i < _count; i++) {
-        _marchers[i]->draw();
+        _marchers[i].render(target, color);
       }
     }
 };
 
 
 
+/** -----------------------------------------------------------------
+  Sparks
+
+  Colored sparks shooting along the edges and fading out. New sparks start
+  anywhere on the lamp, their hue slowly drifts.
+
+  BRIGHTNESS controls brightness
+  MOD controls speed and amount
+*/
+#define SPARK_COUNT 256             // most sparks at once
+#define SPARK_TRAIL 48              // trail fade per frame
+
+class Sparks : public Animation<Sparks>
+{
+  private:
+    ParticleSystem<SPARK_COUNT> _sparks;
+    uint16_t _hue;                  // base hue of new sparks
+
+  public:
+    Sparks() : _hue(_rng.below(HUE_STEPS)) {}
+
+    void update()
+    {
+      uint8_t spawns = 1 + MOD * 8;
+      int16_t speed = PARTICLE_ONE / 8 + MOD * PARTICLE_ONE;
+      for (uint8_t n = 0; n < spawns; n++) {
+        uint8_t edge = _rng.below(EDGE_COUNT);
+        int16_t velocity = speed + _rng.below(speed);
+        _sparks.spawn(edge,
+                      _rng.below(particle_edge_span(edge)),
+                      _rng.below(2) ? velocity : -velocity,
+                      _hue + _rng.below(HUE_STEPS / 6),
+                      PARTICLE_FADE + _rng.below(160));
+      }
+      _hue = (_hue + 1) % HUE_STEPS;
+      _sparks.update(_rng);
+    }
+
+    void render(PixelBuffer& target)
+    {
+      fadeToBlackBy(SPARK_TRAIL, target);
+      _sparks.render(target, PARTICLE_ONE * 3 / 2);
+    }
+};
+
+
+
+/** -----------------------------------------------------------------
+  SineWave
+
+  A sine wave running along x, colored by a rainbow along x that slowly
+  turns.
+
+  BRIGHTNESS controls brightness
+  MOD controls speed
+*/
+#define SINE_FREQUENCY 42           // about one turn per 1570 x
+#define SINE_WIDTH 9830             // half width of the wave, 15% of the height
+
+class SineWave : public Animation<SineWave>
+{
+  private:
+    uint16_t _phase;                // a full turn is 65536
+    uint16_t _hue;
+
+  public:
+    SineWave() :
+      _phase(_rng.next()),
+      _hue(_rng.below(HUE_STEPS))
+    {}
+
+    void update()
+    {
+      _phase += 100 + MOD * 800;
+      _hue = (_hue + 2) % HUE_STEPS;
+    }
+
+    /* wave band, hue along x */
+    inline auto _kernel() const
+    {
+      using namespace shader;
+      return hue_map(
+        sum(_hue, fraction(coord_u(), HUE_STEPS)),
+        255,
+        band(coord_v(), wave(coord_x(), SINE_FREQUENCY, _phase), SINE_WIDTH)
+      );
+    }
+
+    void render(PixelBuffer& target)
+    {
+      setShader(_kernel(), target);
+    }
+
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
+    {
+      setShaderMasked(mask, _kernel(), target);
+    }
+};
+
+
+
 
 /* ========================================================================= */
 /* animation functions */
@@ -554,102 +656,100 @@ class MarchEdges : public Animation
     ANIMATION_TRANSITION
 */
 void update_animation_params() {
-  static bool last_left  = digitalRead(BTN_L_PIN) == HIGH;
-  static bool last_right = digitalRead(BTN_R_PIN) == HIGH;
-
-  bool current_left  = digitalRead(BTN_L_PIN) == HIGH;
-  bool current_right = digitalRead(BTN_R_PIN) == HIGH;
-
-  if (last_left && !current_left) {
-    // left release
+  if (BUTTON_CLICKS & LEFT_CLICK) {
     ANIMATION_TRANSITION--;
-  } else if (last_right && !current_right) {
-    // right release
+  } else if (BUTTON_CLICKS & RIGHT_CLICK) {
     ANIMATION_TRANSITION++;
   }
-  last_left  = current_left;
-  last_right = current_right;
 }
 
 
 
+Transition* active_transition = NULL;   // ongoing transition, NULL if none
+PixelBuffer* transition_buffer = NULL;  // next animation during a transition
+size_t transition_mark;             // top of SCRATCH before the transition
+
 /** -----------------------------------------------------------------
-  animation_transition
+  release_transition
+
+  Destroy the ongoing transition and release its scratch memory.
+*/
+void release_transition() {
+  if (active_transition == NULL)
+    return;
+  active_transition->~Transition();
+  active_transition = NULL;
+  transition_buffer = NULL;
+  SCRATCH.release(transition_mark);
+}
 
-  Fade between animations.
-  This method is called when ANIMATION_TRANSITION is not equal to 0. It
-  draws the given animaiton alongside a trasnsition bar onto the already
-  updated and drawn animation. Afterwards, the ACTIVE_ANIMATION variable
-  is updated accordingly.
 
-  The animation to transition to is an overlay to the currently active
-  animation.
+/** -----------------------------------------------------------------
+  animation_transition
+
+  Transition between animations.
+  This method is called instead of drawing the current animation when
+  ANIMATION_TRANSITION is not equal to 0. A randomly chosen transition (see
+  transitions.h) decides which pixels of the current and of the next
+  animation are visible. Both animations only render those pixels, the
+  next one into an offscreen buffer, which the transition then composes
+  onto the framebuffer. The transition and the offscreen buffer live in
+  SCRATCH until the transition is done. Afterwards, the ACTIVE_ANIMATION
+  variable is updated accordingly, the current animation is destroyed and
+  both slots swap places.
 
   Parameters:
-    Animation* next_animation           animation to transition to.
+    SLOT*& current_animation        already updated active animation.
+    SLOT*& next_animation           animation to transition to.
 
 */
-void animation_transition(Animation* next_animation) {
-  static bool ongoing = false;                    // current state of transition
-  static RgbwColor animation_buffer[NUM_LEDs];    // new animation
-  static RgbwColor transition_buffer[NUM_LEDs];   // transition animation
-  static bool mask[NUM_LEDs];                     // transition mask: false = old, true = new
-
-  /* transition variables */
-  static float t_pos = 0;
-  static const float t_delta = 42;
-  static float t_thickness = 75;
+template<class SLOT>
+void animation_transition(SLOT*& current_animation, SLOT*& next_animation) {
+  Transition*& transition = active_transition;
 
   // first setup
-  if (!ongoing) {
-    // reset all variables
-    ongoing = true;
-    for (uint16_t i = 0; i < NUM_LEDs; i++) {
-      mask[i] = false;
-      transition_buffer[i] = RgbwColor(0);
-      animation_buffer[i] = RgbwColor(0);
+  if (transition == NULL) {
+    transition_mark = SCRATCH.mark();
+    transition_buffer = SCRATCH.create<PixelBuffer>();
+    transition = transition_buffer ? TRANSITIONS[RNG.below(TRANSITION_COUNT)](SCRATCH) : NULL;
+    if (transition == NULL) {
+      // out of scratch memory, stay with the current animation
+      SCRATCH.release(transition_mark);
+      transition_buffer = NULL;
+      ANIMATION_TRANSITION = 0;
+      next_animation->reset();
+      return;
     }
-    // TODO: transition direction depending on ANIMATION_TRANSITION
-    t_pos = 0; //ANIMATION_TRANSITION < 0 ? lamp_x : 0;
+    transition_buffer->clear();
+    transition->begin(ANIMATION_TRANSITION);
   }
+  transition->step();
+
+  // current animation, only where it is still visible
+  current_animation->render_masked(framebuffer, transition->get_current_pixels(), framebuffer);
 
   // get new animation state
   next_animation->update();
-  next_animation->getState(animation_buffer);
-
-  // update params
-  t_pos += t_delta;
+  next_animation->render_masked(*transition_buffer, transition->get_next_pixels(), *transition_buffer);
 
-  // setup transition bar
-  fadeToBlackBy(32 * BRIGHTNESS, transition_buffer);
+  transition->compose(*transition_buffer, framebuffer);
 
-  for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    // update transition bar
-    // TODO: outsource transition into own class
-    if(t_pos - lamp[i].x > 0 && t_pos - lamp[i].x < t_thickness) {
-      transition_buffer[i].W = BRIGHTNESS * 255;
-      mask[i] = true;
-    }
-
-    // draw new animation
-    if (mask[i]) {
-      setPixel(i, animation_buffer[i]);
-    }
-
-    // add transition bar
-    addPixel(i, transition_buffer[i]);
-  }
-
-  if(buffer_empty(transition_buffer)) {
+  if (transition->done()) {
     // end of transition
     ACTIVE_ANIMATION += ANIMATION_TRANSITION + ANIMATION_COUNT;
     ACTIVE_ANIMATION %= ANIMATION_COUNT;
     ANIMATION_TRANSITION = 0;
-    ongoing = false;
+    release_transition();
+
+    // the framebuffer holds the composed frame, not the last draw() of either
+    next_animation->invalidate();
+
+    // only the active animation stays constructed
+    current_animation->reset();
+    std::swap(current_animation, next_animation);
 
     // store active animation
-    EEPROM.write(0, ACTIVE_ANIMATION);
-    EEPROM.commit();
+    journal.set(STATE_ANIMATION, ACTIVE_ANIMATION);
   }
 
 }
@@ -1059,29 +1159,3 @@ void animation_transition(Animation* next_animation) {
 
 
 // }
-
-
-
-// void sine_wave() {
-//   static float tns = 0.3;
-//   static float h = 0;
-
-//   static float t = 0;
-//   clear_strip();
-//   for (int i = 0; i < NUM_LEDs; i++) {
-//     float x = lamp[i].x / 250.0 + t;
-//     float y = ((float) lamp[i].y / lamp_y) * 2 - 1;
-//     if ( abs((y) - (sin(x) * 1.03)) < tns) {
-//       float x_add = (float) lamp[i].x / lamp_x * 360;
-//       float hue = h + x_add > 360 ? h + x_add - 360 : h + x_add;
-//       strip.SetPixelColor(i, Hsvw2Rgbw(h, 1, 1, 0));
-//     }
-//   }
-
-
-//   t += 0.04;
-//   h += 0.5;
-//   if (h > 360) {
-//     h -= 360;
-//   }
-// }
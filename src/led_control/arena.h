@@ -0,0 +1,122 @@
+/** ===========================================================================
+  arena.h
+
+  This file contains the Arena, a stack allocator over a fixed block of
+  static memory. Memory that is only needed for a while (the running
+  transition, temporary arrays of a render call) is taken from the scratch
+  arena SCRATCH instead of being kept in static buffers forever, so users
+  that are never alive at the same time share the same bytes.
+
+  Allocations are released in reverse order: either all at once by
+  returning to a mark, or at the end of a scope through ArenaScope.
+    {
+      ArenaScope scope(SCRATCH);
+      RgbwColor* colors = SCRATCH.allocate<RgbwColor>(NUM_LEDs);
+      ...
+    }                               // colors is released here
+
+  Nothing here touches the heap. Together with the statically sized
+  animation slots (see animation_slot.h), loop() never allocates, so the
+  lamp can run for months without fragmenting the heap.
+*/
+
+#pragma once
+
+#include <new>
+#include <stddef.h>
+#include <stdint.h>
+
+#define ARENA_ALIGN 8               // alignment of every allocation
+
+/** -----------------------------------------------------------------
+  Arena
+
+  Stack allocator over a memory block it does not own.
+*/
+class Arena
+{
+  private:
+    uint8_t* _memory;
+    size_t _size;                   // bytes in _memory
+    size_t _used;                   // bytes allocated
+    size_t _peak;                   // most bytes ever allocated
+
+  public:
+    Arena(uint8_t* memory, size_t size) :
+      _memory(memory),
+      _size(size),
+      _used(0),
+      _peak(0)
+    {}
+
+    /**
+      allocate
+
+      Allocate uninitialized memory for count objects of type T.
+
+      Parameters:
+        size_t count                amount of objects
+
+      Returns:
+        T*                          memory, NULL if the arena is exhausted.
+    */
+    template<class T>
+    T* allocate(size_t count = 1)
+    {
+      size_t start = (_used + ARENA_ALIGN - 1) & ~(size_t) (ARENA_ALIGN - 1);
+      if (start + count * sizeof(T) > _size) {
+        Serial.printf("Arena exhausted: %u of %u bytes used\n", (unsigned) _used, (unsigned) _size);
+        return NULL;
+      }
+      _used = start + count * sizeof(T);
+      if (_used > _peak)
+        _peak = _used;
+      return reinterpret_cast<T*>(_memory + start);
+    }
+
+    /* construct an object in the arena, NULL if the arena is exhausted */
+    template<class T, class... ARGS>
+    T* create(ARGS&&... args)
+    {
+      void* memory = allocate<T>();
+      return memory ? new (memory) T(static_cast<ARGS&&>(args)...) : NULL;
+    }
+
+    /* current top of the arena, see release() */
+    size_t mark() const { return _used; }
+
+    /* release everything allocated since a mark, without destructing it */
+    void release(size_t mark)
+    {
+      if (mark < _used)
+        _used = mark;
+    }
+
+    /* getter */
+    size_t get_size() const { return _size; }
+    size_t get_used() const { return _used; }
+    size_t get_peak() const { return _peak; }
+};
+
+extern Arena SCRATCH;
+
+
+
+/** -----------------------------------------------------------------
+  ArenaScope
+
+  Releases everything allocated from an arena during its lifetime.
+*/
+class ArenaScope
+{
+  private:
+    Arena& _arena;
+    size_t _mark;
+
+  public:
+    ArenaScope(Arena& arena) : _arena(arena), _mark(arena.mark()) {}
+    ~ArenaScope() { _arena.release(_mark); }
+
+    ArenaScope(const ArenaScope&) = delete;
+    ArenaScope& operator=(const ArenaScope&) = delete;
+};
@@ -0,0 +1,149 @@
+/** ===========================================================================
+  compositor.h
+
+  This file contains the Compositor, an animation made of a stack of other
+  animations. Every layer renders into its own buffer, then all layers are
+  blended in a single pass over the pixels, so the target is written once
+  per frame no matter how many layers there are.
+
+  Blend modes (see blend() in packed_color.h):
+    BLEND_ADD                       saturating sum
+    BLEND_MAX                       channel-wise maximum
+    BLEND_MULTIPLY                  product, darkens
+    BLEND_SCREEN                    inverse product, lightens
+    BLEND_OVER                      premultiplied over, alpha is the
+                                    brightest channel
+
+  Every layer also has an opacity, which fades between the stack below it
+  and the blended result.
+
+  The layer animations are part of the Compositor type, so they are called
+  directly and live inside the Compositor.
+*/
+
+#pragma once
+
+#include <initializer_list>
+#include <tuple>
+#include <utility>
+
+#include "animations.h"
+
+/** -----------------------------------------------------------------
+  Layer
+
+  Blending of one layer of a Compositor.
+*/
+struct Layer
+{
+  uint8_t mode;                     // BLEND_* onto the layers below
+  uint8_t opacity;                  // [0,255]
+};
+
+
+
+/** -----------------------------------------------------------------
+  Compositor
+
+  Animation stacking the animations LAYERS, the first one at the bottom.
+  The bottom layer is blended onto black.
+  Layers keep their own buffers, so animations that build on their last
+  frame work as layers as well.
+*/
+template<class... LAYERS>
+class Compositor : public Animation<Compositor<LAYERS...>>
+{
+  public:
+    static constexpr uint8_t LAYER_COUNT = sizeof...(LAYERS);
+
+  private:
+    std::tuple<LAYERS...> _animations;  // animation of every layer
+    Layer _layers[LAYER_COUNT];
+    PixelBuffer _buffers[LAYER_COUNT];  // last frame of every layer
+
+    /* call function(animation, buffer) for every layer, bottom first */
+    template<class FUNCTION, size_t... K>
+    inline void _for_each_layer(FUNCTION&& function, std::index_sequence<K...>)
+    {
+      (function(std::get<K>(_animations), _buffers[K]), ...);
+    }
+
+    template<class FUNCTION>
+    inline void _for_each_layer(FUNCTION&& function)
+    {
+      _for_each_layer(function, std::index_sequence_for<LAYERS...>());
+    }
+
+    /* blend all layers of a pixel and write it to target */
+    inline void _composite(uint16_t pixel, PixelBuffer& target) const
+    {
+      PackedColor color = 0;
+      for (uint8_t k = 0; k < LAYER_COUNT; k++) {
+        PackedColor src = _buffers[k].get_packed(pixel);
+        // black leaves everything but multiply untouched
+        if (src == 0 && _layers[k].mode != BLEND_MULTIPLY)
+          continue;
+        color = blend(_layers[k].mode, _layers[k].opacity, color, src);
+      }
+      target.set_packed(pixel, color);
+    }
+
+  public:
+    /**
+      Constructor
+
+      Parameters:
+        std::initializer_list<Layer> layers
+                                    blending of every layer, bottom first
+        std::tuple<LAYERS...>&& animations
+                                    animation of every layer. Constructed
+                                    in a braced list, they draw their random
+                                    seeds in order.
+    */
+    Compositor(std::initializer_list<Layer> layers, std::tuple<LAYERS...>&& animations) :
+      _animations(std::move(animations))
+    {
+      uint8_t k = 0;
+      for (const Layer& layer : layers) {
+        if (k < LAYER_COUNT)
+          _layers[k++] = layer;
+      }
+    }
+
+    /* change the opacity of a layer */
+    void set_opacity(uint8_t layer, uint8_t opacity)
+    {
+      if (layer < LAYER_COUNT)
+        _layers[layer].opacity = opacity;
+    }
+
+    void update()
+    {
+      _for_each_layer([](auto& animation, PixelBuffer&) { animation.update(); });
+    }
+
+    uint8_t get_dependencies() const
+    {
+      return std::apply([](const LAYERS&... animations) {
+        return (uint8_t) (animations.get_dependencies() | ... | 0);
+      }, _animations);
+    }
+
+    void render(PixelBuffer& target)
+    {
+      _for_each_layer([](auto& animation, PixelBuffer& buffer) { animation.render(buffer); });
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        _composite(i, target);
+      }
+    }
+
+    void render_masked(PixelBuffer& target, const PixelMask& mask, PixelBuffer& scratch)
+    {
+      _for_each_layer([&](auto& animation, PixelBuffer& buffer) {
+        animation.render_masked(buffer, mask, buffer);
+      });
+      mask.for_each([&](uint16_t pixel) {
+        _composite(pixel, target);
+      });
+    }
+};
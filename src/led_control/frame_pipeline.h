@@ -0,0 +1,209 @@
+/** ===========================================================================
+  frame_pipeline.h
+
+  This file contains the pipelined output of finished frames. The render side
+  (loop()) hands every finished frame to an output task running on the other
+  core, which pushes it to the led strip. This way the strip transfer of
+  frame N overlaps the computation of frame N+1.
+
+  Handoff happens through two frame slots and one atomic flag per slot, so
+  neither side ever takes a lock. On the ESP32 the output task is a FreeRTOS
+  task pinned to core 0 (loop() runs on core 1), on a host it is a thread.
+*/
+
+#pragma once
+#include "led_functions.h"
+
+#include <atomic>
+
+#ifndef ESP32
+#include <thread>
+#endif
+
+#define PIPELINE_SLOTS 2              // frames in flight
+#define OUTPUT_TASK_CORE 0            // core to push frames from
+#define OUTPUT_TASK_STACK 4096        // stack size of the output task
+
+/** -----------------------------------------------------------------
+  PipelineFrame
+
+  A frame in flight, with the output settings it was published with.
+*/
+struct PipelineFrame
+{
+  PixelBuffer pixels;               // rendered frame
+  uint16_t brightness;              // global brightness scale
+  bool dither;                      // dither the frame, or round it
+};
+
+
+
+/** -----------------------------------------------------------------
+  FramePipeline
+
+  Single producer, single consumer queue of PIPELINE_SLOTS frames.
+  The producer fills a slot it got from acquire_write() and hands it over
+  with publish(). The consumer gets the oldest published frame from
+  acquire_read() and gives the slot back with release(). Both sides visit
+  the slots in the same order, so frames arrive in the order they were
+  published.
+
+  A slot is owned by the producer while its flag is false and by the
+  consumer while it is true. The release store on hand over and the acquire
+  load on the other side make the slot contents visible before the flag.
+*/
+class FramePipeline
+{
+  private:
+    PipelineFrame _slots[PIPELINE_SLOTS]; // frames in flight
+    std::atomic<bool> _full[PIPELINE_SLOTS];  // slot holds an unshown frame
+    uint8_t _write;                       // next slot of the producer
+    uint8_t _read;                        // next slot of the consumer
+
+    uint32_t _published;                  // frames handed to the consumer
+    uint32_t _stalls;                     // producer found no free slot
+
+  public:
+    FramePipeline() :
+      _write(0),
+      _read(0),
+      _published(0),
+      _stalls(0)
+    {
+      for (uint8_t i = 0; i < PIPELINE_SLOTS; i++) {
+        _full[i].store(false, std::memory_order_relaxed);
+      }
+    }
+
+    /* producer: free slot to render into, NULL if all slots are in flight */
+    PipelineFrame* acquire_write()
+    {
+      if (_full[_write].load(std::memory_order_acquire)) {
+        _stalls++;
+        return NULL;
+      }
+      return &_slots[_write];
+    }
+
+    /* producer: hand the slot from acquire_write() to the consumer */
+    void publish()
+    {
+      _full[_write].store(true, std::memory_order_release);
+      _write = (_write + 1) % PIPELINE_SLOTS;
+      _published++;
+    }
+
+    /* consumer: oldest unshown frame, NULL if there is none */
+    const PipelineFrame* acquire_read()
+    {
+      if (!_full[_read].load(std::memory_order_acquire))
+        return NULL;
+      return &_slots[_read];
+    }
+
+    /* consumer: give the slot from acquire_read() back to the producer */
+    void release()
+    {
+      _full[_read].store(false, std::memory_order_release);
+      _read = (_read + 1) % PIPELINE_SLOTS;
+    }
+
+    /* getter, producer side only */
+    uint32_t get_published() const { return _published; }
+    uint32_t get_stalls() const { return _stalls; }
+};
+
+extern FramePipeline pipeline;
+
+
+
+/**----------------------------------------------------------------------------
+  pipeline_wait
+
+  Give the other side some time while waiting for a slot.
+  On the ESP32 this blocks the task for one tick, so the idle task (and the
+  watchdog) can run on that core. On a host the thread sleeps shortly.
+*/
+inline void pipeline_wait() {
+#ifdef ESP32
+  vTaskDelay(1);
+#else
+  std::this_thread::sleep_for(std::chrono::microseconds(100));
+#endif
+}
+
+
+
+/**----------------------------------------------------------------------------
+  publish_frame
+
+  Hand a finished frame to the output task, replacing show() in loop().
+  Animations fade and add onto their previous frame, so the rendered buffer
+  stays in place and is copied into a free slot, together with the current
+  brightness and dither flag of the output stage. Blocks while both slots
+  are still in flight.
+
+  Parameters:
+    const PixelBuffer& frame (optional)
+                                    frame to show, defaults to the framebuffer
+*/
+void publish_frame(const PixelBuffer& frame = framebuffer) {
+  PipelineFrame* slot;
+  while ((slot = pipeline.acquire_write()) == NULL) {
+    pipeline_wait();
+  }
+  slot->pixels = frame;
+  slot->brightness = output_stage.get_brightness();
+  slot->dither = output_stage.get_dither();
+  pipeline.publish();
+}
+
+
+
+/**----------------------------------------------------------------------------
+  output_frame
+
+  Push the next published frame to the strip, if there is one.
+  This is one iteration of the output task.
+
+  Returns:
+    bool                            true if a frame was shown.
+*/
+bool output_frame() {
+  const PipelineFrame* frame = pipeline.acquire_read();
+  if (frame == NULL)
+    return false;
+  show(frame->pixels, frame->brightness, frame->dither);
+  pipeline.release();
+  return true;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  output_task
+
+  Body of the output task: show frames as soon as they are published.
+*/
+void output_task(void* param) {
+  for (;;) {
+    if (!output_frame())
+      pipeline_wait();
+  }
+}
+
+
+
+/**----------------------------------------------------------------------------
+  start_output_task
+
+  Start the output task on OUTPUT_TASK_CORE. From then on, only the output
+  task may touch the strip.
+*/
+void start_output_task() {
+#ifdef ESP32
+  xTaskCreatePinnedToCore(output_task, "output", OUTPUT_TASK_STACK, NULL, 1, NULL, OUTPUT_TASK_CORE);
+#else
+  std::thread(output_task, (void*) NULL).detach();
+#endif
+}
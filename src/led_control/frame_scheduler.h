@@ -0,0 +1,176 @@
+/** ===========================================================================
+  frame_scheduler.h
+
+  This file contains the FrameScheduler, which paces loop() on absolute
+  deadlines in microseconds. Frame n is due at begin + n * period, so late
+  wake ups and slow frames do not accumulate into drift. Overrunning frames
+  are either caught up or dropped, and the scheduler keeps statistics on
+  jitter, overruns and the slowest frame.
+
+  All times are micros() timestamps. They wrap after ~71 minutes, so they
+  are only ever compared through signed differences.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+
+/* overrun policies */
+#define SCHEDULE_CATCH_UP 0   // keep missed deadlines, run late frames back to back
+#define SCHEDULE_DROP     1   // skip missed deadlines, stay on the frame grid
+
+#define SCHEDULE_MAX_CATCH_UP 4   // periods to catch up at most before dropping
+#define SCHEDULER_STATS_LINE 128  // buffer of print_stats(), lines are 124 bytes at most
+
+/* signed difference of two micros() timestamps */
+inline int32_t micros_diff(uint32_t a, uint32_t b) {
+  return (int32_t) (a - b);
+}
+
+/** -----------------------------------------------------------------
+  FrameScheduler
+
+  Call begin_frame() at the start and end_frame() at the end of every frame.
+  end_frame() sleeps until the next deadline. The timestamped versions do
+  the bookkeeping only and can be driven with any clock.
+
+  Statistics (since the last reset_stats()):
+    frames                          frames run
+    overruns                        frames that ended after their deadline
+    dropped                         deadlines skipped by SCHEDULE_DROP
+    worst                           longest frame [us]
+    jitter                          start of a frame after its deadline [us],
+                                    mean and max
+*/
+class FrameScheduler
+{
+  private:
+    uint32_t _period;               // frame period [us]
+    uint8_t _policy;                // SCHEDULE_*
+    uint32_t _deadline;             // start time of the current frame
+    uint32_t _frame_start;          // actual start of the current frame
+    bool _running;                  // deadlines were initialized
+
+    /* statistics */
+    uint32_t _frames;
+    uint32_t _overruns;
+    uint32_t _dropped;
+    uint32_t _worst;
+    uint32_t _max_jitter;
+    uint64_t _jitter_sum;
+
+  public:
+    FrameScheduler(uint16_t fps, uint8_t policy = SCHEDULE_DROP) :
+      _policy(policy),
+      _running(false)
+    {
+      set_rate(fps);
+      reset_stats();
+    }
+
+    /* change the target frame rate, takes effect with the next deadline */
+    void set_rate(uint16_t fps) { _period = 1000000 / max(fps, (uint16_t) 1); }
+    void set_policy(uint8_t policy) { _policy = policy; }
+
+    void reset_stats()
+    {
+      _frames = 0;
+      _overruns = 0;
+      _dropped = 0;
+      _worst = 0;
+      _max_jitter = 0;
+      _jitter_sum = 0;
+    }
+
+    /**
+      begin_frame
+
+      Mark the start of a frame. The first frame defines the frame grid.
+
+      Parameters:
+        uint32_t now                current time [us]
+    */
+    void begin_frame(uint32_t now)
+    {
+      if (!_running) {
+        _deadline = now;
+        _running = true;
+      }
+      _frame_start = now;
+
+      uint32_t jitter = max(micros_diff(now, _deadline), (int32_t) 0);
+      _max_jitter = max(_max_jitter, jitter);
+      _jitter_sum += jitter;
+    }
+
+    void begin_frame() { begin_frame(micros()); }
+
+    /**
+      end_frame
+
+      Mark the end of a frame and advance to the next deadline according to
+      the overrun policy.
+
+      Parameters:
+        uint32_t now                current time [us]
+
+      Returns:
+        uint32_t                    start time of the next frame
+    */
+    uint32_t end_frame(uint32_t now)
+    {
+      _frames++;
+      _worst = max(_worst, (uint32_t) micros_diff(now, _frame_start));
+
+      uint32_t next = _deadline + _period;
+      int32_t late = micros_diff(now, next);
+      if (late > 0) {
+        _overruns++;
+        uint32_t missed = late / _period + 1;     // deadlines already passed
+        if (_policy == SCHEDULE_DROP || missed > SCHEDULE_MAX_CATCH_UP) {
+          // continue on the next deadline still ahead
+          next += missed * _period;
+          _dropped += missed;
+        }
+      }
+      _deadline = next;
+      return next;
+    }
+
+    /* end the frame and sleep until the next one is due */
+    void end_frame()
+    {
+      uint32_t next = end_frame(micros());
+      int32_t remaining = micros_diff(next, micros());
+      if (remaining <= 0)
+        return;
+
+      // sleep the whole milliseconds, only the rest is waited out actively
+      if (remaining > 1000)
+        delay(remaining / 1000 - 1);
+      remaining = micros_diff(next, micros());
+      if (remaining > 0)
+        delayMicroseconds(remaining);
+    }
+
+    /* getter */
+    uint32_t get_period() const { return _period; }
+    uint32_t get_frames() const { return _frames; }
+    uint32_t get_overruns() const { return _overruns; }
+    uint32_t get_dropped() const { return _dropped; }
+    uint32_t get_worst() const { return _worst; }
+    uint32_t get_max_jitter() const { return _max_jitter; }
+    uint32_t get_mean_jitter() const { return _frames ? _jitter_sum / _frames : 0; }
+
+    /* print the statistics, e.g. before switching animations */
+    void print_stats() const
+    {
+      // Serial.printf() formats longer output than 64 bytes on the heap
+      char line[SCHEDULER_STATS_LINE];
+      int length = snprintf(line, sizeof(line),
+                            "%" PRIu32 " frames, %" PRIu32 " overruns, %" PRIu32 " dropped, worst %" PRIu32
+                            " us, jitter %" PRIu32 "/%" PRIu32 " us (mean/max)\n",
+                            _frames, _overruns, _dropped, _worst, get_mean_jitter(), _max_jitter);
+      Serial.write(line, min(length, (int) sizeof(line) - 1));
+    }
+};
@@ -0,0 +1,118 @@
+/** ===========================================================================
+  graph_walk.h
+
+  This file contains the EdgeWalker, which walks along the edges of the lamp
+  graph (E[] and V[] from pixels.h). At the end of an edge it continues onto
+  an adjacent edge of the vertex it arrived at. All decisions are lookups
+  into the compile time TOPOLOGY tables, so walkers neither allocate nor scan
+  and any amount of them can run side by side.
+*/
+
+#pragma once
+#include "pixels.h"
+#include "rng.h"
+
+/* walk policies, can be combined */
+#define WALK_RANDOM         0x00    // any adjacent edge
+#define WALK_NO_BACKTRACK   0x01    // never take the edge just walked
+#define WALK_WEIGHTED       0x02    // pick edges proportional to a weight
+
+constexpr uint8_t max_vertex_degree()
+{
+  uint8_t degree = 0;
+  for (uint8_t v = 0; v < VERTEX_COUNT; v++) {
+    degree = max(degree, (uint8_t) (TOPOLOGY.vertex_offsets[v + 1] - TOPOLOGY.vertex_offsets[v]));
+  }
+  return degree;
+}
+
+constexpr uint8_t MAX_VERTEX_DEGREE = max_vertex_degree();
+
+
+/** -----------------------------------------------------------------
+  EdgeWalker
+
+  Position on the lamp graph: an edge and the direction it is walked in.
+  Forward means walking from the edge start to the edge end, i.e. with
+  increasing pixel indices.
+*/
+class EdgeWalker
+{
+  private:
+    uint8_t _edge;                  // current edge for E
+    bool _forward;                  // walking direction on the edge
+
+  public:
+    /* start on a random edge in a random direction */
+    EdgeWalker(Rng& rng) :
+      _edge(rng.below(EDGE_COUNT)),
+      _forward(rng.below(2))
+    {}
+
+    EdgeWalker(uint8_t edge, bool forward) :
+      _edge(edge),
+      _forward(forward)
+    {}
+
+    /* getter */
+    uint8_t get_edge() const { return _edge; }
+    bool is_forward() const { return _forward; }
+
+    /* vertex the walker started at */
+    uint8_t get_origin() const { return edge_vertex(_edge, _forward); }
+
+    /* vertex the walker is heading to */
+    uint8_t get_target() const { return edge_vertex(_edge, !_forward); }
+
+    /* first and last pixel in walking direction */
+    uint16_t get_first_pixel() const { return _forward ? E[_edge].get_start() : E[_edge].get_end(); }
+    uint16_t get_last_pixel() const { return _forward ? E[_edge].get_end() : E[_edge].get_start(); }
+
+    /**
+      advance
+
+      Continue onto an adjacent edge of the target vertex. The new edge is
+      entered at that vertex, so its direction follows from the topology.
+
+      Parameters:
+        Rng& rng                    generator for the random decisions
+        uint8_t policy (optional)   combination of WALK_* flags
+        const uint8_t* weights (optional)
+                                    weight per edge for WALK_WEIGHTED.
+                                    Edge lengths are used if not given.
+    */
+    void advance(Rng& rng, uint8_t policy = WALK_NO_BACKTRACK, const uint8_t* weights = NULL)
+    {
+      uint8_t vertex = get_target();
+      uint8_t first = TOPOLOGY.vertex_offsets[vertex];
+      uint8_t size = TOPOLOGY.vertex_offsets[vertex + 1] - first;
+
+      // CSR entry of the edge just walked, excluded when not backtracking
+      int8_t back = -1;
+      if ((policy & WALK_NO_BACKTRACK) && size > 1)
+        back = edge_slot(_edge, !_forward) - first;
+
+      uint8_t slot;
+      if (policy & WALK_WEIGHTED) {
+        uint16_t w[MAX_VERTEX_DEGREE];
+        uint16_t total = 0;
+        for (uint8_t k = 0; k < size; k++) {
+          uint8_t e = TOPOLOGY.vertex_edges[first + k];
+          w[k] = k == back ? 0 : (weights ? weights[e] : E[e].get_length() + 1);
+          total += w[k];
+        }
+        uint16_t r = rng.below(total);
+        slot = 0;
+        while (slot < size - 1 && r >= w[slot]) {
+          r -= w[slot++];
+        }
+      } else {
+        slot = rng.below(back >= 0 ? size - 1 : size);
+        if (back >= 0 && slot >= back)
+          slot++;
+      }
+
+      _edge = TOPOLOGY.vertex_edges[first + slot];
+      _forward = TOPOLOGY.vertex_edge_starts[first + slot];
+    }
+};
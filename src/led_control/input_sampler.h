@@ -0,0 +1,217 @@
+/** ===========================================================================
+  input_sampler.h
+
+  This file contains the sampling of the potis. A task samples both potis
+  at a fixed rate, independent of the frame rate, and filters them:
+    - every sample averages INPUT_OVERSAMPLING conversions,
+    - a median over the last INPUT_MEDIAN samples removes ADC spikes,
+    - an exponential filter smooths the rest.
+  The filter runs per sample, so the input lag is the same at any frame rate.
+
+  The filtered values are published as a snapshot guarded by a sequence
+  counter (seqlock). Readers never block the sampler, and a snapshot always
+  holds both values of the same sample. loop() copies the snapshot into
+  BRIGHTNESS and MOD once per frame (see update_inputs()), so animations
+  read their inputs without touching the ADC.
+
+  On the ESP32 the sampler is a FreeRTOS task pinned to core 0. On a host
+  the potis are scripted, so there is no task: update_inputs() takes the
+  samples of one frame itself, which keeps host runs deterministic.
+*/
+
+#pragma once
+
+#include <atomic>
+
+#define INPUT_SAMPLE_PERIOD 2       // milliseconds between samples
+#define INPUT_OVERSAMPLING 4        // conversions per sample
+#define INPUT_MEDIAN 5              // samples in the median window, odd
+#define INPUT_FILTER_SHIFT 6        // exponential filter weight: 2^-shift
+                                    // time constant: 2^6 * 2 ms = 128 ms
+#define INPUT_TASK_CORE 0           // core to sample on
+#define INPUT_TASK_STACK 2048       // stack size of the sampling task
+#define INPUT_TASK_PRIORITY 2       // above the output task, keeps the rate
+
+#define INPUT_CHANNELS 2            // sampled potis
+#define INPUT_BRIGHTNESS 0          // channel of the brightness poti
+#define INPUT_MOD 1                 // channel of the mod poti
+
+/* full scale of a filtered value: oversampled 12 bit sum, 16 fraction bits */
+#define INPUT_FULL_SCALE (4096.0f * INPUT_OVERSAMPLING * 65536)
+
+
+/** -----------------------------------------------------------------
+  InputSnapshot
+
+  Filtered poti values of one sample, both in [0,1].
+*/
+struct InputSnapshot
+{
+  float brightness;
+  float mod;
+};
+
+
+
+/** -----------------------------------------------------------------
+  InputSampler
+
+  Sampling and filtering of the potis, see the top of this file.
+  sample() must only be called from one task at a time, snapshot() may be
+  called from anywhere.
+
+  The snapshot is written between two increments of _sequence, which is odd
+  while a write is in progress. A reader retries until it read the same
+  even sequence before and after the values.
+*/
+class InputSampler
+{
+  private:
+    const uint8_t _pins[INPUT_CHANNELS] = {POTI_B_PIN, POTI_M_PIN};
+
+    uint16_t _window[INPUT_CHANNELS][INPUT_MEDIAN];  // last oversampled readings
+    uint8_t _next;                  // oldest reading in the windows
+    int32_t _filtered[INPUT_CHANNELS];  // filter state, 16 fraction bits
+    bool _primed;                   // filter state holds a sample
+
+    std::atomic<uint32_t> _sequence;    // odd while the snapshot is written
+    std::atomic<int32_t> _published[INPUT_CHANNELS];  // snapshot values
+    uint32_t _samples;              // samples taken
+
+    /* sum of INPUT_OVERSAMPLING conversions of a pin */
+    uint16_t _read(uint8_t pin) const
+    {
+      uint16_t sum = 0;
+      for (uint8_t n = 0; n < INPUT_OVERSAMPLING; n++) {
+        sum += analogRead(pin);
+      }
+      return sum;
+    }
+
+    /* median of a window */
+    static uint16_t _median(const uint16_t* window)
+    {
+      uint16_t sorted[INPUT_MEDIAN];
+      for (uint8_t i = 0; i < INPUT_MEDIAN; i++) {
+        uint16_t value = window[i];
+        uint8_t k = i;
+        for (; k > 0 && sorted[k - 1] > value; k--) {
+          sorted[k] = sorted[k - 1];
+        }
+        sorted[k] = value;
+      }
+      return sorted[INPUT_MEDIAN / 2];
+    }
+
+    /* write a new snapshot */
+    void _publish()
+    {
+      uint32_t sequence = _sequence.load(std::memory_order_relaxed);
+      _sequence.store(sequence + 1, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_release);
+      for (uint8_t c = 0; c < INPUT_CHANNELS; c++) {
+        _published[c].store(_filtered[c], std::memory_order_relaxed);
+      }
+      _sequence.store(sequence + 2, std::memory_order_release);
+    }
+
+  public:
+    InputSampler() :
+      _next(0),
+      _primed(false),
+      _sequence(0),
+      _samples(0)
+    {
+      for (uint8_t c = 0; c < INPUT_CHANNELS; c++) {
+        _filtered[c] = 0;
+        _published[c].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+      sample
+
+      Take one sample of every poti, filter it and publish the snapshot.
+      The first sample fills the median windows and the filter, so the
+      inputs start at the poti positions instead of fading in from 0.
+    */
+    void sample()
+    {
+      for (uint8_t c = 0; c < INPUT_CHANNELS; c++) {
+        uint16_t reading = _read(_pins[c]);
+        if (!_primed) {
+          for (uint8_t i = 0; i < INPUT_MEDIAN; i++) {
+            _window[c][i] = reading;
+          }
+          _filtered[c] = (int32_t) reading << 16;
+          continue;
+        }
+        _window[c][_next] = reading;
+        int32_t target = (int32_t) _median(_window[c]) << 16;
+        _filtered[c] += (target - _filtered[c]) >> INPUT_FILTER_SHIFT;
+      }
+      _next = (_next + 1) % INPUT_MEDIAN;
+      _primed = true;
+      _samples++;
+      _publish();
+    }
+
+    /* latest filtered values, consistent with each other */
+    InputSnapshot snapshot() const
+    {
+      uint32_t before, after;
+      int32_t values[INPUT_CHANNELS];
+      do {
+        before = _sequence.load(std::memory_order_acquire);
+        for (uint8_t c = 0; c < INPUT_CHANNELS; c++) {
+          values[c] = _published[c].load(std::memory_order_relaxed);
+        }
+        std::atomic_thread_fence(std::memory_order_acquire);
+        after = _sequence.load(std::memory_order_relaxed);
+      } while (before != after || (before & 1));
+
+      return {values[INPUT_BRIGHTNESS] / INPUT_FULL_SCALE,
+              values[INPUT_MOD] / INPUT_FULL_SCALE};
+    }
+
+    /* getter, sampling side only */
+    uint32_t get_samples() const { return _samples; }
+};
+
+extern InputSampler input_sampler;
+
+
+
+/**----------------------------------------------------------------------------
+  input_task
+
+  Body of the sampling task: sample every INPUT_SAMPLE_PERIOD milliseconds.
+  Waiting for an absolute wake time keeps the rate from drifting with the
+  sampling time.
+*/
+#ifdef ESP32
+void input_task(void* param) {
+  TickType_t wake = xTaskGetTickCount();
+  for (;;) {
+    input_sampler.sample();
+    vTaskDelayUntil(&wake, pdMS_TO_TICKS(INPUT_SAMPLE_PERIOD));
+  }
+}
+#endif
+
+
+
+/**----------------------------------------------------------------------------
+  start_input_task
+
+  Take a first sample, so the inputs are valid right away, then start
+  sampling on INPUT_TASK_CORE. From then on, only the sampling task may
+  call input_sampler.sample(). On a host this only takes the first sample.
+*/
+void start_input_task() {
+  input_sampler.sample();
+#ifdef ESP32
+  xTaskCreatePinnedToCore(input_task, "inputs", INPUT_TASK_STACK, NULL,
+                          INPUT_TASK_PRIORITY, NULL, INPUT_TASK_CORE);
+#endif
+}
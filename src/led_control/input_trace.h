@@ -0,0 +1,268 @@
+/** ===========================================================================
+  input_trace.h
+
+  This file contains the recording and replay of input traces. A trace holds
+  everything that makes a run of the sketch differ from another one:
+    - the random seed and the animation active at the start,
+    - BRIGHTNESS and MOD of every frame, bit exact,
+    - the button levels and clicks of every frame.
+  Replaying a trace with freshly constructed animations renders the exact
+  same frame sequence again, so frame hashes (see frame_hash()) of two
+  builds can be compared to check an optimization for identical output.
+
+  Serial commands (see trace_command()):
+    t                               start recording, with a new seed
+    s                               stop recording
+    d                               dump the trace, see InputTrace::dump()
+
+  A trace takes TRACE_FRAMES frames of static memory, so tracing is only
+  compiled in with INPUT_TRACING (see main_vars.h). Without it, TRACE_STEP()
+  and trace_command() do nothing. The host bench always enables it.
+*/
+
+#pragma once
+
+#include <inttypes.h>
+
+#include "pixel_buffer.h"
+#include "utils.h"
+#include "rng.h"
+
+#define TRACE_FRAMES 1024           // frames a trace holds, ~25 s
+
+/* button flags of a trace frame, clicks are stored as in BUTTON_CLICKS */
+#define TRACE_LEFT_DOWN     0x01    // left button pressed
+#define TRACE_RIGHT_DOWN    0x02    // right button pressed
+#define TRACE_CLICKS (LEFT_CLICK | RIGHT_CLICK) // clicks of the frame
+
+/* trace modes */
+#define TRACE_OFF     0
+#define TRACE_RECORD  1
+#define TRACE_REPLAY  2
+
+extern uint8_t ACTIVE_ANIMATION;
+
+
+/** -----------------------------------------------------------------
+  TraceFrame
+
+  Inputs of one frame.
+*/
+struct TraceFrame
+{
+  float brightness;
+  float mod;
+  uint8_t buttons;                  // TRACE_* flags
+};
+
+
+
+/** -----------------------------------------------------------------
+  InputTrace
+
+  Fixed size input trace. step() is called once per frame right after
+  update_inputs(): while recording it appends the inputs of the frame,
+  while replaying it overwrites them with the recorded ones. Both stop on
+  their own at the end of the trace.
+*/
+class InputTrace
+{
+  private:
+    TraceFrame _frames[TRACE_FRAMES];
+    uint16_t _length;               // recorded frames
+    uint16_t _position;             // next frame to replay
+    uint8_t _mode;                  // TRACE_OFF, TRACE_RECORD or TRACE_REPLAY
+    uint32_t _seed;                 // random seed at the start
+    uint8_t _animation;             // active animation at the start
+
+    /* set the inputs to a recorded frame */
+    void _apply(const TraceFrame& frame)
+    {
+      BRIGHTNESS = frame.brightness;
+      MOD = frame.mod;
+      LEFT_BUTTON = frame.buttons & TRACE_LEFT_DOWN;
+      RIGHT_BUTTON = frame.buttons & TRACE_RIGHT_DOWN;
+      BUTTON_CLICKS = frame.buttons & TRACE_CLICKS;
+    }
+
+  public:
+    InputTrace() :
+      _length(0),
+      _position(0),
+      _mode(TRACE_OFF),
+      _seed(1),
+      _animation(0)
+    {}
+
+    /**
+      record
+
+      Start a new recording. RNG is seeded here, so the seed is part of
+      the trace.
+
+      Parameters:
+        uint32_t seed               random seed, not 0
+        uint8_t animation           active animation
+    */
+    void record(uint32_t seed, uint8_t animation)
+    {
+      _seed = seed;
+      _animation = animation;
+      _length = 0;
+      _mode = TRACE_RECORD;
+      RNG.seed(seed);
+    }
+
+    /**
+      replay
+
+      Start replaying from the first frame and reseed RNG.
+      The potis are set to the first frame right away, so animations that
+      are constructed before the first step() see the recorded inputs.
+    */
+    void replay()
+    {
+      _position = 0;
+      _mode = _length > 0 ? TRACE_REPLAY : TRACE_OFF;
+      RNG.seed(_seed);
+      if (_length > 0) {
+        BRIGHTNESS = _frames[0].brightness;
+        MOD = _frames[0].mod;
+      }
+    }
+
+    /* stop recording or replaying */
+    void stop() { _mode = TRACE_OFF; }
+
+    /* record or replay the inputs of the current frame */
+    void step()
+    {
+      if (_mode == TRACE_RECORD) {
+        _frames[_length++] = {BRIGHTNESS, MOD,
+                              (uint8_t) ((LEFT_BUTTON ? TRACE_LEFT_DOWN : 0) |
+                                         (RIGHT_BUTTON ? TRACE_RIGHT_DOWN : 0) |
+                                         BUTTON_CLICKS)};
+        if (_length == TRACE_FRAMES)
+          stop();
+      } else if (_mode == TRACE_REPLAY) {
+        _apply(_frames[_position++]);
+        if (_position == _length)
+          stop();
+      }
+    }
+
+    /**
+      add
+
+      Append a frame, used to load a trace that was dumped before.
+
+      Returns:
+        bool                        false if the trace is full.
+    */
+    bool add(const TraceFrame& frame)
+    {
+      if (_length == TRACE_FRAMES)
+        return false;
+      _frames[_length++] = frame;
+      return true;
+    }
+
+    /* clear the trace and set its start state, used to load a trace */
+    void reset(uint32_t seed, uint8_t animation)
+    {
+      _seed = seed;
+      _animation = animation;
+      _length = 0;
+      _mode = TRACE_OFF;
+    }
+
+    /**
+      dump
+
+      Print the trace to the serial console. The first line holds
+      "trace <seed> <animation> <frames>", every following line one frame
+      as "<brightness> <mod> <buttons>", the floats as hex bit patterns so
+      they load bit exact.
+    */
+    void dump() const
+    {
+      Serial.printf("trace %" PRIu32 " %u %u\n", _seed, _animation, _length);
+      for (uint16_t f = 0; f < _length; f++) {
+        uint32_t brightness, mod;
+        memcpy(&brightness, &_frames[f].brightness, sizeof(float));
+        memcpy(&mod, &_frames[f].mod, sizeof(float));
+        Serial.printf("%08" PRIx32 " %08" PRIx32 " %x\n", brightness, mod, _frames[f].buttons);
+      }
+    }
+
+    /* getter */
+    uint8_t get_mode() const { return _mode; }
+    uint16_t get_length() const { return _length; }
+    uint32_t get_seed() const { return _seed; }
+    uint8_t get_animation() const { return _animation; }
+    const TraceFrame& get_frame(uint16_t frame) const { return _frames[frame]; }
+};
+
+#if INPUT_TRACING
+extern InputTrace input_trace;
+
+#define TRACE_STEP() input_trace.step()
+#else
+#define TRACE_STEP()
+#endif
+
+
+
+/**----------------------------------------------------------------------------
+  frame_hash
+
+  32 bit FNV-1a hash of all pixels of a frame.
+
+  Parameters:
+    const PixelBuffer& frame        frame to hash
+
+  Returns:
+    uint32_t                        hash of the frame.
+*/
+inline uint32_t frame_hash(const PixelBuffer& frame) {
+  uint32_t hash = 2166136261u;
+  const PackedColor* pixels = frame.pixels();
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    for (uint8_t c = 0; c < 4; c++) {
+      hash = (hash ^ ((pixels[i] >> (8 * c)) & 0xff)) * 16777619u;
+    }
+  }
+  return hash;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  trace_command
+
+  Handle a trace command from the serial console.
+
+  Parameters:
+    char command                    received command
+
+  Returns:
+    bool                            true if it was a trace command.
+*/
+bool trace_command(char command) {
+#if INPUT_TRACING
+  switch (command) {
+    case 't':
+      input_trace.record(micros() | 1, ACTIVE_ANIMATION);
+      Serial.println("Recording trace");
+      return true;
+    case 's':
+      input_trace.stop();
+      Serial.printf("Trace stopped, %u frames\n", input_trace.get_length());
+      return true;
+    case 'd':
+      input_trace.dump();
+      return true;
+  }
+#endif
+  return false;
+}
@@ -3,16 +3,32 @@
 /* file imports */
 #pragma once
 
-#include <NeoPixelBus.h>      // LED library
+// The sketch needs C++17 (std::variant, fold expressions, if constexpr).
+// arduino-esp32 builds sketches as C++17 from core 3.0 on, the 2.x cores
+// use gnu++11 and would fail with unreadable template errors.
+static_assert(__cplusplus >= 201703L, "led_control needs C++17, use the arduino-esp32 core 3.0 or newer");
 
-#include <EEPROM.h>           // EEPROM communication
+#include <NeoPixelBus.h>      // LED library
 
-#include <vector>             // vectors
+#include <esp_partition.h>    // flash partitions
 
 #include "main_vars.h"           // master variables
+#include "arena.h"            // scratch memory
+#include "pixel_buffer.h"     // pixel buffers
+#include "rng.h"              // random numbers
 #include "led_functions.h"    // basic led functions
+#include "output_stage.h"     // gamma, brightness and dithering
+#include "input_sampler.h"    // background poti sampling
+#include "frame_pipeline.h"   // pipelined frame output
+#include "frame_scheduler.h"  // frame pacing
+#include "profiler.h"         // stage timing
+#include "input_trace.h"      // input recording and replay
+#include "state_journal.h"    // persistent state
 #include "utils.h"            // 
+#include "transitions.h"      // animation transitions
 #include "animations.h"
+#include "compositor.h"       // layered animations
+#include "animation_slot.h"   // animation registry
 #include "pixels.h"
 
 using namespace std;
@@ -24,8 +40,12 @@ using namespace std;
 
 float BRIGHTNESS = 0, MOD = 0;
 bool LEFT_BUTTON, RIGHT_BUTTON;
+uint8_t BUTTON_CLICKS = 0;
 
-const float INPUT_SMOOTHING = 0.85; // amount of smoothing: [0, 1]
+InputSampler input_sampler;         // filtered poti snapshots
+#if INPUT_TRACING
+InputTrace input_trace;             // recorded or replayed inputs
+#endif
 
 
 
@@ -34,18 +54,106 @@ const float INPUT_SMOOTHING = 0.85; // amount of smoothing: [0, 1]
 
 float MAX_MILLIAMPS = INFINITY;     // max amount of milliamps to draw
 NeoPixelBus<NeoGrbwFeature, NeoSk6812Method> strip(NUM_LEDs, LED_PIN);
+PixelBuffer framebuffer;            // frame to be shown on the strip
+FramePipeline pipeline;             // frames handed to the output task
+OutputStage output_stage;           // gamma, brightness and dithering
 
 
 
 /* ------------------------------------------------------------------------- */
 /* animation handling */
 
-vector<Animation*> animations;      // all animations
+/** -----------------------------------------------------------------
+  Layers
+
+  Edge colors with marchers on top.
+*/
+class Layers : public Compositor<EdgeColors, MarchEdges>
+{
+  public:
+    Layers() :
+      Compositor({{BLEND_OVER, 160}, {BLEND_SCREEN, 255}},
+                 {EdgeColors(), MarchEdges(12)})
+    {}
+};
+
+/* all animations, in switching order */
+typedef AnimationSlot<PlainWhite, HueLight, DiagBars, EdgeColors, MarchEdges, Layers, Sparks,
+                      SineWave> LampAnimation;
+
+LampAnimation animation_slots[2];   // storage of the two animations below
+LampAnimation* active_animation = &animation_slots[0];  // shown animation
+LampAnimation* next_animation = &animation_slots[1];    // transition target
 
 uint8_t ACTIVE_ANIMATION = 0;       // currently active animation
-uint8_t ANIMATION_COUNT;            // amount of animations
+uint8_t ANIMATION_COUNT = LampAnimation::COUNT; // amount of animations
 int8_t ANIMATION_TRANSITION = 0;    // direction change: [-1, 0, 1]
 
+Rng RNG;                            // seeds animation generators, transitions
+
+/* scratch memory, shared by the running transition and render calls */
+#define SCRATCH_SIZE (TRANSITION_SCRATCH + FRAME_SCRATCH)
+alignas(ARENA_ALIGN) uint8_t scratch_memory[SCRATCH_SIZE];
+Arena SCRATCH(scratch_memory, SCRATCH_SIZE);
+
+FrameScheduler scheduler(FPS, SCHEDULE_DROP); // frame pacing
+Profiler PROFILER;                  // stage durations of recent frames
+StateJournal journal;               // state kept across power cycles
+
+
+
+/**----------------------------------------------------------------------------
+  render_frame
+
+  Render the next frame into the framebuffer: update the active animation,
+  then draw it or (possibly) fade to the other animation. The inputs of the
+  frame have to be updated before.
+  The target of a transition is constructed in its first frame.
+*/
+void render_frame() {
+  // update current animation
+  {
+    PROFILE(STAGE_UPDATE);
+    active_animation->update();
+  }
+
+  // (possibly) fade to other animation
+  if (ANIMATION_TRANSITION == 0) {
+    // static animations are only drawn when their inputs change
+    if (active_animation->needs_draw()) {
+      PROFILE(STAGE_DRAW);
+      active_animation->draw();
+    }
+    // only update scene transitions when none are happening
+    update_animation_params();
+  } else {
+    PROFILE(STAGE_TRANSITION);
+    // oddly long calculation to compensate negative modulo
+    uint8_t idx = (ACTIVE_ANIMATION + ANIMATION_TRANSITION + ANIMATION_COUNT) % ANIMATION_COUNT;
+    if (next_animation->index() != idx) {
+      Serial.printf("Switching animation %u -> %u\n", ACTIVE_ANIMATION, idx);
+      next_animation->emplace(idx);
+    }
+    animation_transition(active_animation, next_animation);
+  }
+}
+
+
+
+/**----------------------------------------------------------------------------
+  poll_commands
+
+  Handle pending commands from the serial console, see profiler.h and
+  input_trace.h.
+*/
+void poll_commands() {
+  while (Serial.available() > 0) {
+    char command = Serial.read();
+    if (!profiler_command(command))
+      trace_command(command);
+  }
+}
+
 
 
 /* ========================================================================= */
@@ -55,7 +163,11 @@ void setup()
 {
   /* util setup */
   Serial.begin(115200);
-  randomSeed(analogRead(0));
+#ifdef ESP32
+  RNG.seed(esp_random());
+#else
+  RNG.seed(analogRead(0));
+#endif
 
   /* I/O setup*/
   pinMode(POTI_B_PIN, INPUT);
@@ -64,58 +176,71 @@ void setup()
   pinMode(BTN_R_PIN, INPUT_PULLUP);
   pinMode(LED_PIN, OUTPUT);
 
-  EEPROM.begin(EEPROM_SIZE);
+  /* restore state from flash */
+  start_journal();
+
+  /* inputs are valid before any animation reads them */
+  start_input_task();
+  update_inputs();
 
   /* set lamp parameters */
   init_lamp();
 
-  /* set animations */
-  animations.push_back(new PlainWhite());
-  animations.push_back(new HueLight());
-  animations.push_back(new DiagBars());
-  animations.push_back(new EdgeColors());
-  // animations.push_back(new MarchEdges());
-
-  ANIMATION_COUNT = animations.size();
-  ACTIVE_ANIMATION = EEPROM.read(0) % ANIMATION_COUNT;
+  /* construct the active animation only */
+  uint32_t animation = 0;
+  journal.get(STATE_ANIMATION, animation);
+  ACTIVE_ANIMATION = animation % ANIMATION_COUNT;
+  active_animation->emplace(ACTIVE_ANIMATION);
 
   /* led setup */
   strip.Begin();
   strip.Show();
+
+#if PIPELINED_OUTPUT
+  start_output_task();
+#endif
 }
 
 
 void loop() {
-  /* timing variables */
-  static unsigned long frame_start;
-  static unsigned long frame_time;
+  static uint8_t timed_animation = ACTIVE_ANIMATION;
+  static uint16_t unchanged_frames = 0;
 
-  // measure frame start time
-  frame_start = millis();
-  
-  update_inputs();
-  
-  // draw current animation
-  animations[ACTIVE_ANIMATION]->update();
-  animations[ACTIVE_ANIMATION]->draw();
+  scheduler.begin_frame();
 
-  // (possibly) fade to other animation
-  if (ANIMATION_TRANSITION == 0) {
-    // only update scene transitions when none are happening
-    update_animation_params();
-  } else {
-    // oddly long calculation to compensate negative modulo
-    uint8_t idx = (ACTIVE_ANIMATION + ANIMATION_TRANSITION + ANIMATION_COUNT) % ANIMATION_COUNT;
-    Serial.printf("Switching animation %u -> %u\n", ACTIVE_ANIMATION, idx);
-    animation_transition(animations[idx]);
+  {
+    PROFILE(STAGE_INPUTS);
+    update_inputs();
+    TRACE_STEP();
   }
 
-  // show frame
-  show();
+  render_frame();
+
+  // show frame, unchanged frames only every KEEPALIVE_FRAMES
+  bool changed = output_stage.set_brightness(BRIGHTNESS) | framebuffer.is_dirty();
+  if (changed || ++unchanged_frames >= KEEPALIVE_FRAMES) {
+    // changing frames are dithered, a resent frame has to look the same
+    output_stage.set_dither(changed);
+    framebuffer.clear_dirty();
+    unchanged_frames = 0;
+#if PIPELINED_OUTPUT
+    publish_frame();
+#else
+    show();
+#endif
+  }
 
-  // calculate frame delay
-  frame_time = millis() - frame_start;
-  if(frame_time < FRAME_DELAY) {
-    delay(FRAME_DELAY - frame_time);
+  // report frame timing of an animation when leaving it
+  if (timed_animation != ACTIVE_ANIMATION) {
+    Serial.printf("Animation %u: ", timed_animation);
+    scheduler.print_stats();
+    scheduler.reset_stats();
+    timed_animation = ACTIVE_ANIMATION;
   }
+
+  // profiler and trace console
+  poll_commands();
+
+  // wait for the next frame
+  scheduler.end_frame();
 }
@@ -1,15 +1,20 @@
-
 /** ===========================================================================
   led_functions.h
 
   This file contains basic led functions.
-  TODO: add buffer compatibility to all functions.
+  All functions write to a PixelBuffer. If no buffer is given, the framebuffer
+  is modified, which is sent to the led strip by show().
 */
 
 #pragma once
 #include "utils.h"
+#include "rng.h"
+#include "pixel_mask.h"
+#include "output_stage.h"
+#include "profiler.h"
 
 extern NeoPixelBus<NeoGrbwFeature, NeoSk6812Method> strip;
+extern PixelBuffer framebuffer;
 
 /* ========================================================================= */
 /* single-pixel functions */
@@ -22,9 +27,10 @@ extern NeoPixelBus<NeoGrbwFeature, NeoSk6812Method> strip;
   Parameters:
   uint16_t pixel                    pixel to write to
   RgbwColor color                   RGBW color
+  PixelBuffer& buffer (optional)    buffer to write to
 */
-inline void setPixel(uint16_t pixel, RgbwColor color) {
-  strip.SetPixelColor(pixel, color);
+inline void setPixel(uint16_t pixel, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  buffer.set(pixel, color);
 }
 
 
@@ -37,16 +43,16 @@ inline void setPixel(uint16_t pixel, RgbwColor color) {
   Parameters:
     uint16_t pixel                  pixel to write to
     RgbwColor color                 RGBW color
+    PixelBuffer& buffer (optional)  buffer to write to
 */
-void addPixel(uint16_t pixel, RgbwColor color) {
-  RgbwColor current = strip.GetPixelColor(pixel);
-  RgbwColor result = RgbwColor(
-                       constrain(current.R + color.R, 0, 255),
-                       constrain(current.G + color.G, 0, 255),
-                       constrain(current.B + color.B, 0, 255),
-                       constrain(current.W + color.W, 0, 255)
-                     );
-  setPixel(pixel, result);
+inline void addPixel(uint16_t pixel, PackedColor color, PixelBuffer& buffer = framebuffer) {
+  if (pixel >= NUM_LEDs)
+    return;
+  buffer.set_packed(pixel, packed_add(buffer.get_packed(pixel), color));
+}
+
+inline void addPixel(uint16_t pixel, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  addPixel(pixel, pack(color), buffer);
 }
 
 
@@ -66,20 +72,42 @@ void addPixel(uint16_t pixel, RgbwColor color) {
     uint16_t start_point            pixel index to start from
     uint16_t end_point              pixel index of last pixel (exclusive)
     RgbwColor color                 RGBW color
+    PixelBuffer& buffer (optional)  buffer to write to
 */
 
-void setSolid(uint16_t start_point, uint16_t end_point, RgbwColor color) {
+void setSolid(uint16_t start_point, uint16_t end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
   for (uint16_t i = start_point; i < end_point; i++) {
-    setPixel(i, color);
+    setPixel(i, color, buffer);
   }
 }
 
-void setSolid(uint16_t end_point, RgbwColor color) {
-  setSolid(0, end_point, color);
+void setSolid(uint16_t end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  setSolid(0, end_point, color, buffer);
 }
 
-void setSolid(RgbwColor color) {
-  setSolid(0, NUM_LEDs, color);
+void setSolid(RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  setSolid(0, NUM_LEDs, color, buffer);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  setMasked
+
+  Set all pixels of a mask to a given color, leaving all other pixels as
+  they are.
+
+  Parameters:
+    const PixelMask& mask           pixels to set
+    RgbwColor color                 RGBW color
+    PixelBuffer& buffer (optional)  buffer to write to
+*/
+
+void setMasked(const PixelMask& mask, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  PackedColor packed = pack(color);
+  mask.for_each([&](uint16_t pixel) {
+    buffer.set_packed(pixel, packed);
+  });
 }
 
 
@@ -97,20 +125,22 @@ void setSolid(RgbwColor color) {
     uint16_t start_point            pixel index to start from
     uint16_t end_point              pixel index of last pixel (non-inclusive)
     RgbwColor color                 RGBW color
+    PixelBuffer& buffer (optional)  buffer to write to
 */
 
-void addSolid(uint16_t start_point, uint16_t end_point, RgbwColor color) {
+void addSolid(uint16_t start_point, uint16_t end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  PackedColor packed = pack(color);
   for (uint16_t i = start_point; i < end_point; i++) {
-    addPixel(i, color);
+    addPixel(i, packed, buffer);
   }
 }
 
-void addSolid(uint16_t end_point, RgbwColor color) {
-  addSolid(0, end_point, color);
+void addSolid(uint16_t end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  addSolid(0, end_point, color, buffer);
 }
 
-void addSolid(RgbwColor color) {
-  addSolid(0, NUM_LEDs, color);
+void addSolid(RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  addSolid(0, NUM_LEDs, color, buffer);
 }
 
 
@@ -127,16 +157,17 @@ void addSolid(RgbwColor color) {
     float start_point               starting position
     float end_point                 end position
     RgbwColor color                 RBGW color
+    PixelBuffer& buffer (optional)  buffer to write to
 */
 
-void setFloat(float start_point, float end_point, RgbwColor color) {
+void setFloat(float start_point, float end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
   start_point = constrain(start_point, 0, NUM_LEDs);
   end_point   = constrain(end_point,   0, NUM_LEDs);
 
   // first segment
   float first_seg_length = min(end_point - start_point, start_point - (uint16_t) start_point);
   uint8_t dim = 255 * (1 - first_seg_length);
-  setPixel((uint16_t) start_point, RgbwColor(color.Dim(dim)));
+  setPixel((uint16_t) start_point, RgbwColor(color.Dim(dim)), buffer);
 
   if (end_point - start_point < start_point - (uint16_t) start_point) {
     // segment only on one pixel
@@ -144,22 +175,22 @@ void setFloat(float start_point, float end_point, RgbwColor color) {
   }
 
   // middle segment
-  setSolid(ceil(start_point), floor(end_point), color);
+  setSolid(ceil(start_point), floor(end_point), color, buffer);
 
 
   // last segment
   dim = 255 * (end_point - (uint16_t) end_point);
   RgbwColor res_color = color.Dim(dim);
-  setPixel((uint16_t) end_point, res_color);
+  setPixel((uint16_t) end_point, res_color, buffer);
 }
 
-void setFloat(float end_point, RgbwColor color) {
-  setFloat(0, end_point, color);
+void setFloat(float end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  setFloat(0, end_point, color, buffer);
 }
 
-void setFloat(RgbwColor color) {
+void setFloat(RgbwColor color, PixelBuffer& buffer = framebuffer) {
   // this is essentially setSolid
-  setSolid(0, NUM_LEDs, color);
+  setSolid(0, NUM_LEDs, color, buffer);
 }
 
 
@@ -176,13 +207,14 @@ void setFloat(RgbwColor color) {
     float start_point               starting position
     float end_point                 end position
     RgbwColor color                 RBGW color
+    PixelBuffer& buffer (optional)  buffer to write to
 */
-void addFloat(float start_point, float end_point, RgbwColor color) {
+void addFloat(float start_point, float end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
 
   // first segment
   float first_seg_length = min(end_point - start_point, start_point - (uint16_t) start_point);
   uint8_t dim = 255 * (1 - first_seg_length);
-  addPixel((uint16_t) start_point, RgbwColor(color.Dim(dim)));
+  addPixel((uint16_t) start_point, RgbwColor(color.Dim(dim)), buffer);
 
   if (end_point - start_point < start_point - (uint16_t) start_point) {
     // segment only on one pixel
@@ -190,22 +222,22 @@ void addFloat(float start_point, float end_point, RgbwColor color) {
   }
 
   // middle segment
-  addSolid(ceil(start_point), floor(end_point), color);
+  addSolid(ceil(start_point), floor(end_point), color, buffer);
 
 
   // last segment
   dim = 255 * (end_point - (uint16_t) end_point);
   RgbwColor res_color = color.Dim(dim);
-  addPixel((uint16_t) end_point, res_color);
+  addPixel((uint16_t) end_point, res_color, buffer);
 }
 
-void addFloat(float end_point, RgbwColor color) {
-  addFloat(0, end_point, color);
+void addFloat(float end_point, RgbwColor color, PixelBuffer& buffer = framebuffer) {
+  addFloat(0, end_point, color, buffer);
 }
 
-void addFloat(RgbwColor color) {
+void addFloat(RgbwColor color, PixelBuffer& buffer = framebuffer) {
   // this is essentially addSolid
-  addSolid(0, NUM_LEDs, color);
+  addSolid(0, NUM_LEDs, color, buffer);
 }
 
 
@@ -217,35 +249,16 @@ void addFloat(RgbwColor color) {
   fadeToBlackBy
 
    Fade all lights to black by some steps.
-   If no buffer is given or the buffer is NULL, the strip active strip is
-   modified.
+   If no buffer is given, the framebuffer is modified.
 
    Parameters:
     uint8_t amount                  amount of steps to reduce color values
-    RgbwColor* buffer               scene to fade instead of led strip
+    PixelBuffer& buffer (optional)  buffer to fade
 */
-void fadeToBlackBy(uint8_t amount) {
+void fadeToBlackBy(uint8_t amount, PixelBuffer& buffer = framebuffer) {
+  PackedColor sub = packed_splat(amount);
   for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    RgbwColor current = strip.GetPixelColor(i);
-    RgbwColor new_color = RgbwColor(
-                            max(0, current.R - amount),
-                            max(0, current.G - amount),
-                            max(0, current.B - amount),
-                            max(0, current.W - amount)
-                          );
-    setPixel(i, new_color);
-  }
-}
-
-void fadeToBlackBy(uint8_t amount, RgbwColor* buffer) {
-  if (buffer == NULL)
-    return fadeToBlackBy(amount);
-
-  for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    buffer[i].R = max(0, buffer[i].R - amount);
-    buffer[i].G = max(0, buffer[i].G - amount);
-    buffer[i].B = max(0, buffer[i].B - amount);
-    buffer[i].W = max(0, buffer[i].W - amount);
+    buffer.set_packed(i, packed_sub(buffer.get_packed(i), sub));
   }
 }
 
@@ -255,29 +268,26 @@ void fadeToBlackBy(uint8_t amount, RgbwColor* buffer) {
   fadeToBlackRandom
 
   Fade all lights to black by a random amount each. Lower and upper bounds
-  can be given. If not, they are defaulted to 0 and 128.
+  can be given. If not, they are defaulted to 0 and 128. All amounts are
+  drawn in one batch, four per generator step.
 
   Parameters:
+    Rng& rng                        generator to draw the amounts from
     uint8_t lower                   lower boundary
     uint8_t upper                   upper boundary
+    PixelBuffer& buffer (optional)  buffer to fade
 */
 
-void fadeToBlackRandom(uint8_t lower, uint8_t upper) {
+void fadeToBlackRandom(Rng& rng, uint8_t lower, uint8_t upper, PixelBuffer& buffer = framebuffer) {
+  uint8_t amounts[NUM_LEDs];
+  rng.fill(amounts, NUM_LEDs, lower, upper);
   for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    RgbwColor current = strip.GetPixelColor(i);
-    uint8_t amount = random(lower, upper);
-    RgbwColor new_color = RgbwColor(
-                            max(0, current.R - amount),
-                            max(0, current.G - amount),
-                            max(0, current.B - amount),
-                            max(0, current.W - amount)
-                          );
-    setPixel(i, new_color);
+    buffer.set_packed(i, packed_sub(buffer.get_packed(i), packed_splat(amounts[i])));
   }
 }
 
-void fadeToBlackRandom() {
-  fadeToBlackRandom(0, 128);
+void fadeToBlackRandom(Rng& rng, PixelBuffer& buffer = framebuffer) {
+  fadeToBlackRandom(rng, 0, 128, buffer);
 }
 
 
@@ -289,17 +299,18 @@ void fadeToBlackRandom() {
 
   Parameters:
     float factor                    multiplication factor
+    PixelBuffer& buffer (optional)  buffer to modify
 */
 
-void multByFactor(float factor) {
+void multByFactor(float factor, PixelBuffer& buffer = framebuffer) {
   for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    RgbwColor color = strip.GetPixelColor(i);
+    RgbwColor color = buffer.get(i);
     setPixel(i, RgbwColor(
                           constrain(color.R * factor, 0, 255),
                           constrain(color.G * factor, 0, 255),
                           constrain(color.B * factor, 0, 255),
                           constrain(color.W * factor, 0, 255)
-                        ));
+                        ), buffer);
   }
 }
 
@@ -309,32 +320,50 @@ void multByFactor(float factor) {
   clear_strip
 
   Turn off all lights.
+
+  Parameters:
+    PixelBuffer& buffer (optional)  buffer to clear
 */
-void clear_strip() {
-  for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    setPixel(i, RgbwColor(0));
-  }
+inline void clear_strip(PixelBuffer& buffer = framebuffer) {
+  buffer.clear();
 }
 
 
 /**----------------------------------------------------------------------------
   show
 
-  Show the LED strip.
-  LED colors are dimmed to keep current draw under MAX_MILLIAMPS.
+  Show a frame on the LED strip.
+  The frame goes through the output stage (see output_stage.h) on its way
+  into the strip's wire format, in a single pass: gamma correction, global
+  brightness, current limit and dithering. The scale is reduced to keep
+  current draw under MAX_MILLIAMPS. The frame itself is left untouched.
   If MAX_MILLIAMPS was not set or is set to INFINITY, this check will be
   skipped.
+
+  Parameters:
+    const PixelBuffer& frame        frame to show
+    uint16_t brightness             global brightness scale of the frame
+    bool dither                     dither the frame, or round it
 */
-void show() {
+void show(const PixelBuffer& frame, uint16_t brightness, bool dither) {
+  uint16_t scale = brightness;
 
   if (MAX_MILLIAMPS != INFINITY) {
-    int draw = calculate_milliamps();
-    if (draw > MAX_MILLIAMPS) {
-      // dimm all leds
-      float fac = (float) MAX_MILLIAMPS / draw;
-      multByFactor(fac * 0.95); // just to be sure
-    }
+    PROFILE(STAGE_MILLIAMPS);
+    scale = output_stage.limit_current(frame, scale, MAX_MILLIAMPS);
   }
 
+  output_stage.begin_frame(dither);
+  const PackedColor* pixels = frame.pixels();
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    strip.SetPixelColor(i, output_stage.map(pixels[i], i, scale));
+  }
+
+  PROFILE(STAGE_SHOW);
   strip.Show();
 }
+
+/* show a frame with the current brightness and dither flag */
+void show(const PixelBuffer& frame = framebuffer) {
+  show(frame, output_stage.get_brightness(), output_stage.get_dither());
+}
@@ -8,8 +8,6 @@
 
 #define NUM_LEDs 392      // LED count
 
-#define EEPROM_SIZE 1     // bytes usesd in EEPROM
-
 /* pin declaration */
 #define POTI_M_PIN 34     // mod poti pin
 #define POTI_B_PIN 35     // brightness poti pin
@@ -18,4 +16,11 @@
 #define LED_PIN 22        // led output pin
 
 #define FRAME_DELAY 25    // milliseconds per frame
-#define FPS 1000 / FRAME_DELAY    // animation fps
\ No newline at end of file
+#define FPS 1000 / FRAME_DELAY    // animation fps
+#define KEEPALIVE_FRAMES 40       // frames between resends of an unchanged frame
+
+#define PIPELINED_OUTPUT 1  // show frames from a task on the other core
+#define PROFILING 1         // record stage durations, see profiler.h
+#ifndef INPUT_TRACING
+#define INPUT_TRACING 0     // record and replay inputs, ~12 KB RAM, see input_trace.h
+#endif
\ No newline at end of file
@@ -0,0 +1,169 @@
+/** ===========================================================================
+  output_stage.h
+
+  This file contains the output stage, which turns a rendered frame into
+  the values sent to the strip. Animations render at full brightness, so
+  every frame uses the whole 8 bit range. On the way out, a single fixed
+  point pass per pixel
+    - expands every channel to 16 bits through a per-channel gamma table,
+    - scales it by the global brightness and the current limit, and
+    - rounds it back to 8 bits with temporal dithering.
+  Low brightness levels therefore keep their gradients instead of collapsing
+  onto a few 8 bit steps.
+
+  The brightness and the dither flag are atomic, so they can be read
+  outside of loop(). The pipelined output (see frame_pipeline.h) reads them
+  when a frame is published and passes them on with the frame, so every
+  frame is shown with the values it was rendered for.
+*/
+
+#pragma once
+
+#include <atomic>
+
+#include "pixel_buffer.h"
+#include "utils.h"
+
+#define GAMMA_RGB 2.2               // gamma of the color channels
+#define GAMMA_W 2.2                 // gamma of the white channel
+#define BRIGHTNESS_STEPS 1023       // resolution of the brightness input
+#define DITHER_FRAMES 8             // frames of a dither cycle, power of 2
+
+/* dither offsets in bit reversed order, so every cycle prefix is spread out */
+const uint8_t DITHER_OFFSETS[DITHER_FRAMES] = {16, 144, 80, 208, 48, 176, 112, 240};
+#define DITHER_NONE 128             // offset without dithering: round
+
+/** -----------------------------------------------------------------
+  OutputStage
+
+  Gamma tables and global scaling of the strip output.
+  Scales are 16 bit fixed point, 65535 is full scale.
+*/
+class OutputStage
+{
+  private:
+    uint16_t _gamma[4][256];        // gamma tables, R, G, B, W
+    std::atomic<uint16_t> _brightness;    // global brightness scale
+    std::atomic<bool> _dither;      // dither the next frames
+    bool _dithering;                // dither the current frame
+    uint8_t _phase;                 // dither phase of the current frame
+
+    /* scale a 16 bit value and round it to 8 bits */
+    static inline uint8_t _channel(uint32_t value, uint32_t scale, uint32_t offset)
+    {
+      uint32_t res = (((value * scale) >> 16) + offset) >> 8;
+      return res > 255 ? 255 : res;
+    }
+
+  public:
+    OutputStage() :
+      _brightness(65535),
+      _dither(false),
+      _dithering(false),
+      _phase(0)
+    {
+      for (uint16_t v = 0; v < 256; v++) {
+        _gamma[0][v] = _gamma[1][v] = _gamma[2][v] = lround(65535 * pow(v / 255.0, GAMMA_RGB));
+        _gamma[3][v] = lround(65535 * pow(v / 255.0, GAMMA_W));
+      }
+    }
+
+    /**
+      set_brightness
+
+      Set the global brightness. The input is quantized to BRIGHTNESS_STEPS
+      and goes through the white gamma curve, so the poti feels linear.
+
+      Parameters:
+        float brightness            brightness: [0,1]
+
+      Returns:
+        bool                        true if the output changes.
+    */
+    bool set_brightness(float brightness)
+    {
+      float level = round(constrain(brightness, 0, 1) * BRIGHTNESS_STEPS) / BRIGHTNESS_STEPS;
+      uint16_t scale = lround(65535 * pow(level, GAMMA_W));
+      return _brightness.exchange(scale, std::memory_order_relaxed) != scale;
+    }
+
+    /* dither the following frames, or round them */
+    void set_dither(bool dither) { _dither.store(dither, std::memory_order_relaxed); }
+
+    /**
+      limit_current
+
+      Reduce a scale so showing the frame stays below a current limit.
+      Gamma never raises a channel, so the channel sum of the frame bounds
+      the current. Only if that bound is too high, the exact gamma corrected
+      current is computed.
+
+      Parameters:
+        const PixelBuffer& frame    frame to show
+        uint16_t scale              scale without limit
+        float max_milliamps         current limit
+
+      Returns:
+        uint16_t                    limited scale.
+    */
+    uint16_t limit_current(const PixelBuffer& frame, uint16_t scale, float max_milliamps) const
+    {
+      if (((uint64_t) calculate_milliamps(frame) * scale >> 16) <= max_milliamps)
+        return scale;
+
+      uint64_t sum = 0;
+      const PackedColor* pixels = frame.pixels();
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        PackedColor c = pixels[i];
+        sum += _gamma[0][c & 0xff] + _gamma[1][(c >> 8) & 0xff] +
+               _gamma[2][(c >> 16) & 0xff] + _gamma[3][c >> 24];
+      }
+      // max. 20 mA per channel at full scale
+      float draw = sum * (scale / 65535.0f) * 20 / 65535;
+      if (draw <= max_milliamps)
+        return scale;
+      return scale * (max_milliamps / draw) * 0.95; // just to be sure
+    }
+
+    /* start a frame, advancing the dither cycle */
+    void begin_frame(bool dither)
+    {
+      _dithering = dither;
+      _phase = (_phase + 1) % DITHER_FRAMES;
+    }
+
+    /* start a frame with the dither flag of set_dither() */
+    void begin_frame() { begin_frame(get_dither()); }
+
+    /* current global brightness scale */
+    uint16_t get_brightness() const { return _brightness.load(std::memory_order_relaxed); }
+
+    /* dither flag of the following frames */
+    bool get_dither() const { return _dither.load(std::memory_order_relaxed); }
+
+    /**
+      map
+
+      Map a rendered pixel to the color sent to the strip.
+
+      Parameters:
+        PackedColor color           rendered color
+        uint16_t pixel              pixel index, spreads the dither phases
+        uint16_t scale              brightness and current scale
+
+      Returns:
+        RgbwColor                   color for the strip.
+    */
+    inline RgbwColor map(PackedColor color, uint16_t pixel, uint32_t scale) const
+    {
+      uint32_t offset = _dithering ? DITHER_OFFSETS[(_phase + pixel) % DITHER_FRAMES] : DITHER_NONE;
+      return RgbwColor(
+               _channel(_gamma[0][color & 0xff], scale, offset),
+               _channel(_gamma[1][(color >> 8) & 0xff], scale, offset),
+               _channel(_gamma[2][(color >> 16) & 0xff], scale, offset),
+               _channel(_gamma[3][color >> 24], scale, offset)
+             );
+    }
+};
+
+extern OutputStage output_stage;
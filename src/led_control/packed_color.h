@@ -0,0 +1,283 @@
+/** ===========================================================================
+  packed_color.h
+
+  This file contains the packed 32 bit pixel representation used by the
+  PixelBuffer. All four channels live in one uint32_t, so saturating
+  arithmetic can work on all of them at once (SIMD within a register).
+
+  Layout:
+    bits  0 -  7                    R
+    bits  8 - 15                    G
+    bits 16 - 23                    B
+    bits 24 - 31                    W
+
+  Every SWAR operation has a scalar *_reference counterpart that works
+  channel by channel. Those are only meant for checking the fast versions.
+*/
+
+#pragma once
+
+typedef uint32_t PackedColor;
+
+#define PACKED_LOW7  0x7f7f7f7fu   // lower 7 bits of every channel
+#define PACKED_HIGH  0x80808080u   // top bit of every channel
+#define PACKED_RB    0x00ff00ffu   // R and B channel
+#define PACKED_GW    0xff00ff00u   // G and W channel
+
+
+/* ========================================================================= */
+/* conversion */
+
+inline PackedColor pack(RgbwColor color) {
+  return (uint32_t) color.R
+         | ((uint32_t) color.G << 8)
+         | ((uint32_t) color.B << 16)
+         | ((uint32_t) color.W << 24);
+}
+
+inline RgbwColor unpack(PackedColor color) {
+  return RgbwColor(color, color >> 8, color >> 16, color >> 24);
+}
+
+/* same value in all four channels */
+inline PackedColor packed_splat(uint8_t value) {
+  return value * 0x01010101u;
+}
+
+
+
+/* ========================================================================= */
+/* SWAR arithmetic */
+
+/* turn the top bit of every channel into a full 0xff channel mask */
+inline uint32_t _packed_high_to_mask(uint32_t high) {
+  return (high >> 7) * 0xff;
+}
+
+/**----------------------------------------------------------------------------
+  packed_add
+
+  Add two colors, saturating each channel at 255.
+*/
+inline PackedColor packed_add(PackedColor a, PackedColor b) {
+  uint32_t sum = (a & PACKED_LOW7) + (b & PACKED_LOW7);
+  uint32_t res = sum ^ ((a ^ b) & PACKED_HIGH);
+  uint32_t carry = ((a & b) | ((a | b) & ~res)) & PACKED_HIGH;
+  return res | _packed_high_to_mask(carry);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_sub
+
+  Subtract b from a, saturating each channel at 0.
+*/
+inline PackedColor packed_sub(PackedColor a, PackedColor b) {
+  uint32_t diff = (a | PACKED_HIGH) - (b & PACKED_LOW7);
+  uint32_t res = diff ^ ((a ^ ~b) & PACKED_HIGH);
+  uint32_t borrow = ((~a & b) | (~(a ^ b) & res)) & PACKED_HIGH;
+  return res & ~_packed_high_to_mask(borrow);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_scale
+
+  Scale all channels by ratio / 256, rounding like RgbwColor::Dim.
+*/
+inline PackedColor packed_scale(PackedColor color, uint8_t ratio) {
+  uint32_t fac = (uint32_t) ratio + 1;
+  uint32_t rb = (((color & PACKED_RB) * fac) >> 8) & PACKED_RB;
+  uint32_t gw = (((color >> 8) & PACKED_RB) * fac) & PACKED_GW;
+  return rb | gw;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_max
+
+  Channel-wise maximum of two colors.
+*/
+inline PackedColor packed_max(PackedColor a, PackedColor b) {
+  // b + max(a - b, 0) never overflows a channel
+  return b + packed_sub(a, b);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_lerp
+
+  Linear interpolation between two colors, t = 0 gives a and t = 255 gives b.
+  In between, channels are within 1 of the rounded exact value.
+*/
+inline PackedColor packed_lerp(PackedColor a, PackedColor b, uint8_t t) {
+  // map t to [0,256], so both ends are exact
+  uint32_t f = t + (t >> 7);
+  uint32_t rb = (((a & PACKED_RB) * (256 - f) + (b & PACKED_RB) * f + 0x00800080u) >> 8) & PACKED_RB;
+  uint32_t gw = (((a >> 8) & PACKED_RB) * (256 - f) + ((b >> 8) & PACKED_RB) * f + 0x00800080u) & PACKED_GW;
+  return rb | gw;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_mul
+
+  Channel-wise product of two colors, a * b / 255 rounded. Channels have
+  different factors, so this works channel by channel.
+*/
+inline uint8_t _mul255(uint32_t a, uint32_t b) {
+  uint32_t x = a * b + 128;
+  return (x + (x >> 8)) >> 8;
+}
+
+inline PackedColor packed_mul(PackedColor a, PackedColor b) {
+  return (uint32_t) _mul255(a & 0xff, b & 0xff)
+         | ((uint32_t) _mul255((a >> 8) & 0xff, (b >> 8) & 0xff) << 8)
+         | ((uint32_t) _mul255((a >> 16) & 0xff, (b >> 16) & 0xff) << 16)
+         | ((uint32_t) _mul255(a >> 24, b >> 24) << 24);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_screen
+
+  Channel-wise screen of two colors, 255 - (255 - a) * (255 - b) / 255.
+*/
+inline PackedColor packed_screen(PackedColor a, PackedColor b) {
+  return ~packed_mul(~a, ~b);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_max_channel
+
+  Largest channel value of a color.
+*/
+inline uint8_t packed_max_channel(PackedColor color) {
+  // fold the upper half onto the lower one, twice
+  PackedColor half = packed_max(color, color >> 16);
+  return packed_max(half, half >> 8) & 0xff;
+}
+
+
+
+/**----------------------------------------------------------------------------
+  packed_channel_sum
+
+  Sum of all channel values, see channelSum().
+*/
+inline uint16_t packed_channel_sum(PackedColor color) {
+  uint32_t pairs = (color & PACKED_RB) + ((color >> 8) & PACKED_RB);
+  return (pairs & 0xffff) + (pairs >> 16);
+}
+
+
+
+/* ========================================================================= */
+/* blend modes */
+
+#define BLEND_ADD       0
+#define BLEND_MAX       1
+#define BLEND_MULTIPLY  2
+#define BLEND_SCREEN    3
+#define BLEND_OVER      4
+
+/**----------------------------------------------------------------------------
+  blend
+
+  Blend a layer color onto the color of the stack below it.
+  For BLEND_OVER, src is premultiplied and its brightest channel is its
+  alpha, so src covers dst by that much: src + dst * (255 - alpha) / 255.
+  Black is fully transparent, a color with a full channel fully opaque.
+
+  Parameters:
+    uint8_t mode                    BLEND_*
+    uint8_t opacity                 opacity of the layer: [0,255]
+    PackedColor dst                 color below the layer
+    PackedColor src                 color of the layer
+
+  Returns:
+    PackedColor                     blended color.
+*/
+inline PackedColor blend(uint8_t mode, uint8_t opacity, PackedColor dst, PackedColor src) {
+  PackedColor res;
+  switch (mode) {
+    case BLEND_ADD:       res = packed_add(dst, src); break;
+    case BLEND_MAX:       res = packed_max(dst, src); break;
+    case BLEND_MULTIPLY:  res = packed_mul(dst, src); break;
+    case BLEND_SCREEN:    res = packed_screen(dst, src); break;
+    default:              res = packed_add(src, packed_scale(dst, 255 - packed_max_channel(src))); break;
+  }
+  return opacity == 255 ? res : packed_lerp(dst, res, opacity);
+}
+
+
+
+/* ========================================================================= */
+/* scalar references */
+
+inline PackedColor packed_add_reference(PackedColor a, PackedColor b) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(
+                min(x.R + y.R, 255),
+                min(x.G + y.G, 255),
+                min(x.B + y.B, 255),
+                min(x.W + y.W, 255)
+              ));
+}
+
+inline PackedColor packed_sub_reference(PackedColor a, PackedColor b) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(
+                max(x.R - y.R, 0),
+                max(x.G - y.G, 0),
+                max(x.B - y.B, 0),
+                max(x.W - y.W, 0)
+              ));
+}
+
+inline PackedColor packed_scale_reference(PackedColor color, uint8_t ratio) {
+  return pack(unpack(color).Dim(ratio));
+}
+
+inline PackedColor packed_mul_reference(PackedColor a, PackedColor b) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(
+                (uint8_t) lround(x.R * y.R / 255.0),
+                (uint8_t) lround(x.G * y.G / 255.0),
+                (uint8_t) lround(x.B * y.B / 255.0),
+                (uint8_t) lround(x.W * y.W / 255.0)
+              ));
+}
+
+inline PackedColor packed_screen_reference(PackedColor a, PackedColor b) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(
+                255 - (uint8_t) lround((255 - x.R) * (255 - y.R) / 255.0),
+                255 - (uint8_t) lround((255 - x.G) * (255 - y.G) / 255.0),
+                255 - (uint8_t) lround((255 - x.B) * (255 - y.B) / 255.0),
+                255 - (uint8_t) lround((255 - x.W) * (255 - y.W) / 255.0)
+              ));
+}
+
+inline PackedColor packed_max_reference(PackedColor a, PackedColor b) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(max(x.R, y.R), max(x.G, y.G), max(x.B, y.B), max(x.W, y.W)));
+}
+
+inline PackedColor packed_lerp_reference(PackedColor a, PackedColor b, uint8_t t) {
+  RgbwColor x = unpack(a), y = unpack(b);
+  return pack(RgbwColor(
+                (uint8_t) lround((x.R * (255 - t) + y.R * t) / 255.0),
+                (uint8_t) lround((x.G * (255 - t) + y.G * t) / 255.0),
+                (uint8_t) lround((x.B * (255 - t) + y.B * t) / 255.0),
+                (uint8_t) lround((x.W * (255 - t) + y.W * t) / 255.0)
+              ));
+}
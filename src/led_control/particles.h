@@ -0,0 +1,221 @@
+/** ===========================================================================
+  particles.h
+
+  This file contains a particle system on the lamp graph. Particles move
+  along the edges (E[] from pixels.h) and continue onto an adjacent edge at
+  every vertex they reach, like an EdgeWalker.
+
+  Particles are stored as a structure of arrays: one array per property, so
+  the per-frame update runs as tight loops over plain integers. Positions
+  and velocities are fixed point with PARTICLE_SHIFT fractional bits, in
+  pixels along the edge. Rendering adds an anti-aliased span per particle,
+  with the colors of all particles converted in one batch.
+
+  A particle is at most PARTICLE_MAX_SPEED pixels per frame fast, which is
+  less than the shortest edge, so it crosses at most one vertex per frame.
+*/
+
+#pragma once
+
+#include "pixels.h"
+#include "graph_walk.h"
+#include "led_functions.h"
+#include "arena.h"
+#include "rng.h"
+#include "utils.h"
+
+#define PARTICLE_SHIFT 8            // fractional bits of positions
+#define PARTICLE_ONE (1 << PARTICLE_SHIFT)  // one pixel
+#define PARTICLE_MAX_SPEED (4 * PARTICLE_ONE)   // per frame
+#define PARTICLE_FADE 32            // frames a particle fades out before dying
+
+/* length of an edge in fixed point pixels */
+constexpr int16_t particle_edge_span(uint8_t edge) {
+  return (E[edge].get_length() + 1) << PARTICLE_SHIFT;
+}
+
+/**----------------------------------------------------------------------------
+  addSpan
+
+  Add a color to a fixed point span of an edge. Pixels that are only
+  partly covered get the covered fraction of the color. The span is
+  clipped to the edge.
+
+  Parameters:
+    uint8_t edge                    edge for E
+    int16_t from                    start of the span from the edge start,
+                                    in fixed point pixels
+    int16_t to                      end of the span, excluded
+    PackedColor color               color of fully covered pixels
+    PixelBuffer& buffer             buffer to write to
+*/
+inline void addSpan(uint8_t edge, int16_t from, int16_t to, PackedColor color, PixelBuffer& buffer) {
+  from = max(from, (int16_t) 0);
+  to = min(to, particle_edge_span(edge));
+  uint16_t start = E[edge].get_start();
+  for (int16_t p = from >> PARTICLE_SHIFT; (p << PARTICLE_SHIFT) < to; p++) {
+    int16_t left = max(from, (int16_t) (p << PARTICLE_SHIFT));
+    int16_t right = min(to, (int16_t) ((p + 1) << PARTICLE_SHIFT));
+    int16_t coverage = right - left;
+    addPixel(start + p, coverage >= PARTICLE_ONE ? color : packed_scale(color, coverage - 1), buffer);
+  }
+}
+
+
+
+/** -----------------------------------------------------------------
+  ParticleSystem
+
+  Up to CAPACITY particles on the lamp graph. Every particle has an edge, a
+  position on it (from the edge start) and a velocity (positive towards the
+  edge end), a hue and the frames it has left to live.
+*/
+template<uint16_t CAPACITY>
+class ParticleSystem
+{
+  // colors of all particles have to fit into one render call's scratch
+  static_assert(CAPACITY <= NUM_LEDs, "particle colors have to fit FRAME_SCRATCH");
+
+  private:
+    uint8_t _edge[CAPACITY];        // edge for E
+    int16_t _position[CAPACITY];    // fixed point pixels from the edge start
+    int16_t _velocity[CAPACITY];    // fixed point pixels per frame
+    uint16_t _hue[CAPACITY];        // [0,HUE_STEPS)
+    uint8_t _life[CAPACITY];        // frames left
+    uint16_t _count;                // living particles, the first ones
+
+    /* move a particle that left its edge onto the next one */
+    void _cross(uint16_t i, Rng& rng, uint8_t policy)
+    {
+      bool forward = _position[i] >= 0;
+      int16_t overshoot = forward ? _position[i] - particle_edge_span(_edge[i]) : -1 - _position[i];
+
+      EdgeWalker walker(_edge[i], forward);
+      walker.advance(rng, policy);
+      uint8_t edge = walker.get_edge();
+      int16_t span = particle_edge_span(edge);
+      overshoot = min(overshoot, (int16_t) (span - 1));
+
+      int16_t speed = abs(_velocity[i]);
+      _edge[i] = edge;
+      _position[i] = walker.is_forward() ? overshoot : span - 1 - overshoot;
+      _velocity[i] = walker.is_forward() ? speed : -speed;
+    }
+
+    /* remove a particle, the last one takes its place */
+    void _remove(uint16_t i)
+    {
+      _count--;
+      _edge[i] = _edge[_count];
+      _position[i] = _position[_count];
+      _velocity[i] = _velocity[_count];
+      _hue[i] = _hue[_count];
+      _life[i] = _life[_count];
+    }
+
+  public:
+    ParticleSystem() : _count(0) {}
+
+    /**
+      spawn
+
+      Add a particle.
+
+      Parameters:
+        uint8_t edge                edge for E
+        int16_t position            fixed point pixels from the edge start
+        int16_t velocity            fixed point pixels per frame, positive
+                                    towards the edge end
+        uint16_t hue                [0,HUE_STEPS)
+        uint8_t life                frames to live, 0 dies right away
+
+      Returns:
+        bool                        false if the system is full.
+    */
+    bool spawn(uint8_t edge, int16_t position, int16_t velocity, uint16_t hue, uint8_t life)
+    {
+      if (_count == CAPACITY || edge >= EDGE_COUNT)
+        return false;
+      _edge[_count] = edge;
+      _position[_count] = constrain(position, 0, particle_edge_span(edge) - 1);
+      _velocity[_count] = constrain(velocity, -PARTICLE_MAX_SPEED, PARTICLE_MAX_SPEED);
+      _hue[_count] = hue % HUE_STEPS;
+      _life[_count] = life;
+      _count++;
+      return true;
+    }
+
+    /* remove all particles */
+    void clear() { _count = 0; }
+
+    /**
+      update
+
+      Advance all particles by one frame. Particles reaching a vertex
+      continue on an adjacent edge, dead ones are removed.
+
+      Parameters:
+        Rng& rng                    generator for the edges taken at vertices
+        uint8_t policy (optional)   combination of WALK_* flags
+    */
+    void update(Rng& rng, uint8_t policy = WALK_NO_BACKTRACK)
+    {
+      for (uint16_t i = 0; i < _count; i++) {
+        _position[i] += _velocity[i];
+      }
+      for (uint16_t i = 0; i < _count; i++) {
+        _life[i] -= _life[i] > 0;
+      }
+
+      // negative positions wrap to large ones, one comparison covers both ends
+      for (uint16_t i = 0; i < _count; i++) {
+        if ((uint16_t) _position[i] >= (uint16_t) particle_edge_span(_edge[i]))
+          _cross(i, rng, policy);
+      }
+
+      for (uint16_t i = 0; i < _count; ) {
+        if (_life[i] == 0)
+          _remove(i);
+        else
+          i++;
+      }
+    }
+
+    /**
+      render
+
+      Add all particles to a buffer, as spans of a given size centered on
+      their positions. Particles fade out during their last PARTICLE_FADE
+      frames.
+
+      Parameters:
+        PixelBuffer& target         buffer to add the particles to
+        int16_t size (optional)     span size in fixed point pixels
+    */
+    void render(PixelBuffer& target, int16_t size = PARTICLE_ONE)
+    {
+      ArenaScope scope(SCRATCH);
+      HsvColor* hsv = SCRATCH.allocate<HsvColor>(_count);
+      RgbwColor* rgbw = SCRATCH.allocate<RgbwColor>(_count);
+      if (!hsv || !rgbw)
+        return;
+
+      for (uint16_t i = 0; i < _count; i++) {
+        uint8_t value = _life[i] >= PARTICLE_FADE ? 255 : _life[i] * 255 / PARTICLE_FADE;
+        hsv[i] = {_hue[i], 255, value};
+      }
+      Hsvw2Rgbw(hsv, rgbw, _count);
+
+      int16_t half = size / 2;
+      for (uint16_t i = 0; i < _count; i++) {
+        addSpan(_edge[i], _position[i] - half, _position[i] - half + size, pack(rgbw[i]), target);
+      }
+    }
+
+    /* getter */
+    uint16_t get_count() const { return _count; }
+    uint8_t get_edge(uint16_t i) const { return _edge[i]; }
+    int16_t get_position(uint16_t i) const { return _position[i]; }
+    int16_t get_velocity(uint16_t i) const { return _velocity[i]; }
+    uint8_t get_life(uint16_t i) const { return _life[i]; }
+};
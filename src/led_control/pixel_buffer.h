@@ -0,0 +1,87 @@
+/** ===========================================================================
+  pixel_buffer.h
+
+  This file contains the PixelBuffer class, a linear array of NUM_LEDs
+  packed colors. The framebuffer as well as all offscreen buffers (e.g. for
+  transitions) are PixelBuffers, so every led function and animation can
+  render into either of them.
+*/
+
+#pragma once
+#include "packed_color.h"
+
+/**----------------------------------------------------------------------------
+  channelSum
+
+  Sum of all channel values of a given color.
+
+  Parameters:
+  RgbwColor color             color.
+
+  Returns:
+  uint16_t                    R + G + B + W.
+*/
+inline uint16_t channelSum(RgbwColor color) {
+  return color.R + color.G + color.B + color.W;
+}
+
+
+
+/** -----------------------------------------------------------------
+  PixelBuffer
+
+  Buffer of NUM_LEDs colors. The sum of all channel values is kept up to date
+  on every write, so current draw and emptiness can be queried in O(1).
+  Writes that change a pixel mark the buffer dirty, so unchanged frames do
+  not have to be sent to the strip again.
+  Colors are stored packed (see packed_color.h), RgbwColor accessors are
+  provided for convenience.
+*/
+class PixelBuffer
+{
+  private:
+    PackedColor _pixels[NUM_LEDs];  // pixel colors
+    uint32_t _channel_sum;          // sum of all channel values
+    bool _dirty;                    // pixels changed since clear_dirty()
+
+  public:
+    PixelBuffer() :
+      _channel_sum(0),
+      _dirty(true)
+    {
+      clear();
+    }
+
+    /* get pixel color */
+    inline PackedColor get_packed(uint16_t pixel) const { return _pixels[pixel]; }
+    inline RgbwColor get(uint16_t pixel) const { return unpack(_pixels[pixel]); }
+
+    /* set pixel color, out of range pixels are ignored */
+    inline void set_packed(uint16_t pixel, PackedColor color)
+    {
+      if (pixel >= NUM_LEDs)
+        return;
+      _channel_sum += packed_channel_sum(color) - packed_channel_sum(_pixels[pixel]);
+      _dirty |= color != _pixels[pixel];
+      _pixels[pixel] = color;
+    }
+    inline void set(uint16_t pixel, RgbwColor color) { set_packed(pixel, pack(color)); }
+
+    /* turn off all pixels */
+    void clear()
+    {
+      _dirty |= _channel_sum != 0;
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        _pixels[i] = 0;
+      }
+      _channel_sum = 0;
+    }
+
+    /* forget about previous changes */
+    void clear_dirty() { _dirty = false; }
+
+    /* getter */
+    uint32_t channel_sum() const { return _channel_sum; }
+    bool is_dirty() const { return _dirty; }
+    const PackedColor* pixels() const { return _pixels; }
+};
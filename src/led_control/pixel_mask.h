@@ -0,0 +1,115 @@
+/** ===========================================================================
+  pixel_mask.h
+
+  This file contains the PixelMask class, a bit-packed set of lamp pixels.
+  One bit per pixel keeps the whole mask in a few dozen bytes, and empty
+  regions can be skipped a word at a time.
+*/
+
+#pragma once
+
+#define MASK_WORDS ((NUM_LEDs + 31) / 32)  // 32 bit words per mask
+
+/** -----------------------------------------------------------------
+  PixelMask
+
+  Set of pixels, one bit each. The amount of set pixels is kept up to date
+  on every write, so emptiness and completeness can be queried in O(1).
+*/
+class PixelMask
+{
+  private:
+    uint32_t _words[MASK_WORDS];    // pixel bits, pixel i is bit i % 32 of word i / 32
+    uint16_t _count;                // amount of set pixels
+
+  public:
+    PixelMask() { clear(); }
+
+    /* remove all pixels */
+    void clear()
+    {
+      for (uint8_t w = 0; w < MASK_WORDS; w++) {
+        _words[w] = 0;
+      }
+      _count = 0;
+    }
+
+    /* add all pixels */
+    void fill()
+    {
+      for (uint8_t w = 0; w < MASK_WORDS; w++) {
+        _words[w] = 0xffffffffu;
+      }
+      // keep the bits past NUM_LEDs clear
+      if (NUM_LEDs % 32)
+        _words[MASK_WORDS - 1] = (1u << (NUM_LEDs % 32)) - 1;
+      _count = NUM_LEDs;
+    }
+
+    /* true if the pixel is in the mask */
+    inline bool get(uint16_t pixel) const
+    {
+      return pixel < NUM_LEDs && (_words[pixel / 32] >> (pixel % 32)) & 1;
+    }
+
+    /**
+      set
+
+      Add a pixel to the mask. Out of range pixels are ignored.
+
+      Returns:
+        bool                        true if the pixel was not set before.
+    */
+    inline bool set(uint16_t pixel)
+    {
+      if (pixel >= NUM_LEDs)
+        return false;
+      uint32_t bit = 1u << (pixel % 32);
+      if (_words[pixel / 32] & bit)
+        return false;
+      _words[pixel / 32] |= bit;
+      _count++;
+      return true;
+    }
+
+    /**
+      unset
+
+      Remove a pixel from the mask. Out of range pixels are ignored.
+
+      Returns:
+        bool                        true if the pixel was set before.
+    */
+    inline bool unset(uint16_t pixel)
+    {
+      if (!get(pixel))
+        return false;
+      _words[pixel / 32] &= ~(1u << (pixel % 32));
+      _count--;
+      return true;
+    }
+
+    /**
+      for_each
+
+      Call f(pixel) for every pixel in the mask, in ascending order. Empty
+      words are skipped as a whole.
+    */
+    template<typename F>
+    void for_each(F f) const
+    {
+      for (uint8_t w = 0; w < MASK_WORDS; w++) {
+        uint32_t bits = _words[w];
+        while (bits) {
+          f((uint16_t) (w * 32 + __builtin_ctz(bits)));
+          bits &= bits - 1;
+        }
+      }
+    }
+
+    /* getter */
+    uint16_t count() const { return _count; }
+    bool empty() const { return _count == 0; }
+    bool full() const { return _count == NUM_LEDs; }
+    const uint32_t* words() const { return _words; }
+};
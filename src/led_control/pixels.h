@@ -5,27 +5,38 @@
   This file contains the parameters for the lamp. Yes, I actually put these
   values in manually.
 
-  The init_lamp() function call is mandatory to be called if the use of edges
-  and vertices is desires.
+  The init_lamp() function call is mandatory to be called if the use of
+  projections is desired.
+
+  All coordinate and topology tables are computed at compile time and live in
+  flash.
 
   This file provides:
-    Pixel lamp[NUM_LEDs]            lamp pixel coordinates
+    Pixel lamp[NUM_LEDs]            lamp pixel coordinates (source values)
     uint16_t lamp_x                 max x coordinate of lamp
     uint16_t lamp_y                 max y coordinate of lamp
+    LampTables LAMP                 per-pixel coordinate tables, accessed by
+                                    pixel_x(), pixel_y(), pixel_u(),
+                                    pixel_v(), pixel_angle(), pixel_radius()
+    Projection PROJ_X, PROJ_Y       pixels sorted by x, y
+    Projection PROJ_SUM, PROJ_DIFF  pixels sorted by x + y, x - y
+    Projection PROJ_RADIUS          pixels sorted by distance to the center
     Vertex V[]                      physical lamp vertices
     Edge E[]                        physical lamp edges
+    LampTopology TOPOLOGY           edge/vertex adjacency and per-pixel edge
+                                    tables, see pixel_edge(), pixel_vertex()
 */
 
 #pragma once
 
-#include <vector>
+#include <algorithm>
 
 struct Pixel {
   uint16_t x, y;
-  Pixel(uint16_t x_, uint16_t y_) : x(x_), y(y_) {}
+  constexpr Pixel(uint16_t x_, uint16_t y_) : x(x_), y(y_) {}
 };
 
-Pixel lamp[392] {
+constexpr Pixel lamp[NUM_LEDs] {
   // 0
   Pixel(0, 730), Pixel(0, 698), Pixel(0, 662), Pixel(0, 628), Pixel(0, 596), Pixel(0, 562), Pixel(0, 528), Pixel(0, 492), Pixel(0, 460), Pixel(0, 426), Pixel(0, 392), Pixel(0, 358), Pixel(0, 324), Pixel(0, 290), Pixel(0, 258), Pixel(0, 222), Pixel(0, 190), Pixel(0, 156), Pixel(0, 122), Pixel(0, 88), Pixel(0, 54), Pixel(0, 20),
   // 1
@@ -78,8 +89,220 @@ Pixel lamp[392] {
   Pixel(482, 0), Pixel(449, 0), Pixel(416, 0), Pixel(383, 0), Pixel(349, 0), Pixel(316, 0), Pixel(283, 0), Pixel(248, 0), Pixel(215, 0), Pixel(181, 0), Pixel(146, 0), Pixel(112, 0), Pixel(78, 0), Pixel(42, 0), Pixel(6, 0)
 };
 
-uint16_t lamp_x = 1780;
-uint16_t lamp_y = 740;
+constexpr uint16_t lamp_x = 1780;
+constexpr uint16_t lamp_y = 740;
+
+
+/* ========================================================================= */
+/* compile time coordinate tables */
+
+/* compile time math, only meant for building the tables below */
+namespace lamp_math {
+
+  constexpr double sqrt(double value)
+  {
+    if (value <= 0)
+      return 0;
+    double root = value > 1 ? value : 1;
+    for (uint8_t i = 0; i < 64; i++) {
+      root = 0.5 * (root + value / root);
+    }
+    return root;
+  }
+
+  constexpr double atan(double z)
+  {
+    bool negative = z < 0;
+    if (negative)
+      z = -z;
+    bool inverted = z > 1;
+    if (inverted)
+      z = 1 / z;
+    // halve the angle twice to speed up the series: atan(z) = 2 atan(z / (1 + sqrt(1 + z^2)))
+    z = z / (1 + sqrt(1 + z * z));
+    z = z / (1 + sqrt(1 + z * z));
+    double sum = 0, term = z;
+    for (uint8_t n = 0; n < 20; n++) {
+      sum += (n % 2 ? -term : term) / (2 * n + 1);
+      term *= z * z;
+    }
+    sum *= 4;
+    if (inverted)
+      sum = PI / 2 - sum;
+    return negative ? -sum : sum;
+  }
+
+  constexpr double atan2(double y, double x)
+  {
+    if (x > 0)
+      return atan(y / x);
+    if (x < 0)
+      return y < 0 ? atan(y / x) - PI : atan(y / x) + PI;
+    return y > 0 ? PI / 2 : (y < 0 ? -PI / 2 : 0);
+  }
+}
+
+
+/** -----------------------------------------------------------------
+  LampTables
+
+  Structure-of-arrays view of all lamp pixels.
+
+  Members:
+    uint16_t x, y                   raw coordinates
+    uint16_t u, v: [0,65535]        coordinates normalized by lamp_x, lamp_y
+    uint16_t angle: [0,65535]       angle around the lamp center, a full turn
+                                    is 65536, measured from +x towards +y
+    uint16_t radius                 distance to the lamp center
+*/
+#define LAMP_CENTER_X (lamp_x / 2.0)
+#define LAMP_CENTER_Y (lamp_y / 2.0)
+
+struct LampTables {
+  uint16_t x[NUM_LEDs];
+  uint16_t y[NUM_LEDs];
+  uint16_t u[NUM_LEDs];
+  uint16_t v[NUM_LEDs];
+  uint16_t angle[NUM_LEDs];
+  uint16_t radius[NUM_LEDs];
+};
+
+constexpr LampTables make_lamp_tables()
+{
+  LampTables t {};
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    t.x[i] = lamp[i].x;
+    t.y[i] = lamp[i].y;
+    t.u[i] = (uint32_t) lamp[i].x * 65535 / lamp_x;
+    t.v[i] = (uint32_t) lamp[i].y * 65535 / lamp_y;
+
+    double dx = lamp[i].x - LAMP_CENTER_X;
+    double dy = lamp[i].y - LAMP_CENTER_Y;
+    double turns = lamp_math::atan2(dy, dx) / (2 * PI);
+    if (turns < 0)
+      turns += 1;
+    t.angle[i] = (uint32_t) (turns * 65536 + 0.5) & 0xffff;
+    t.radius[i] = lamp_math::sqrt(dx * dx + dy * dy) + 0.5;
+  }
+  return t;
+}
+
+constexpr LampTables LAMP = make_lamp_tables();
+
+/* per-pixel accessors */
+inline uint16_t pixel_x(uint16_t pixel) { return LAMP.x[pixel]; }
+inline uint16_t pixel_y(uint16_t pixel) { return LAMP.y[pixel]; }
+inline uint16_t pixel_u(uint16_t pixel) { return LAMP.u[pixel]; }
+inline uint16_t pixel_v(uint16_t pixel) { return LAMP.v[pixel]; }
+inline uint16_t pixel_angle(uint16_t pixel) { return LAMP.angle[pixel]; }
+inline uint16_t pixel_radius(uint16_t pixel) { return LAMP.radius[pixel]; }
+
+
+/** -----------------------------------------------------------------
+  PixelSpan
+
+  Result of a projection range query: pixel indices and their keys, both
+  sorted by key.
+*/
+struct PixelSpan {
+  const uint16_t* pixels;           // pixel indices for lamp
+  const int16_t* keys;              // projected coordinate of each pixel
+  uint16_t count;                   // amount of pixels
+};
+
+
+/** -----------------------------------------------------------------
+  Projection
+
+  All lamp pixels sorted by a key, usually a linear projection of their
+  coordinates, key = x_fac * x + y_fac * y. Band-shaped effects query the pixels inside a
+  key range instead of testing every pixel, so their cost scales with the
+  lit area instead of NUM_LEDs.
+*/
+class Projection
+{
+  private:
+    uint16_t _pixels[NUM_LEDs];     // pixel indices, sorted by key
+    int16_t _keys[NUM_LEDs];        // sorted keys
+
+  public:
+    /**
+      build_by
+
+      Sort all lamp pixels by an arbitrary key.
+
+      Parameters:
+        KeyFn key                   key(pixel), has to fit into int16_t
+    */
+    template<typename KeyFn>
+    void build_by(KeyFn key)
+    {
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        _pixels[i] = i;
+      }
+      sort(_pixels, _pixels + NUM_LEDs, [&key](uint16_t a, uint16_t b) {
+        return key(a) < key(b);
+      });
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        _keys[i] = key(_pixels[i]);
+      }
+    }
+
+    /**
+      build
+
+      Sort all lamp pixels by their projected coordinate.
+
+      Parameters:
+        int8_t x_fac                factor of x coordinate
+        int8_t y_fac                factor of y coordinate
+    */
+    void build(int8_t x_fac, int8_t y_fac)
+    {
+      build_by([x_fac, y_fac](uint16_t i) {
+        return x_fac * pixel_x(i) + y_fac * pixel_y(i);
+      });
+    }
+
+    /* all pixels, sorted by key */
+    PixelSpan all() const
+    {
+      return {_pixels, _keys, NUM_LEDs};
+    }
+
+    /**
+      range
+
+      Get all pixels with lower <= key < upper.
+
+      Returns:
+        PixelSpan                   pixels inside the range.
+    */
+    PixelSpan range(int32_t lower, int32_t upper) const
+    {
+      lower = constrain(lower, INT16_MIN, INT16_MAX);
+      upper = constrain(upper, INT16_MIN, INT16_MAX);
+      const int16_t* first = lower_bound(_keys, _keys + NUM_LEDs, lower);
+      const int16_t* last = lower_bound(first, _keys + NUM_LEDs, upper);
+      uint16_t offset = first - _keys;
+      return {_pixels + offset, first, (uint16_t) (last - first)};
+    }
+
+    /**
+      band
+
+      Get all pixels with |key - center| < radius.
+
+      Returns:
+        PixelSpan                   pixels inside the band.
+    */
+    PixelSpan band(int32_t center, int32_t radius) const
+    {
+      return range(center - radius + 1, center + radius);
+    }
+};
+
+Projection PROJ_X, PROJ_Y, PROJ_SUM, PROJ_DIFF, PROJ_RADIUS;
 
 
 /** -----------------------------------------------------------------
@@ -95,19 +318,19 @@ class Edge
     uint16_t _start, _end;           // start and end pixel indices
 
   public:
-    Edge(uint16_t start, uint16_t end) :
+    constexpr Edge(uint16_t start, uint16_t end) :
       _start(min(start, end)),
       _end(  max(start, end))
     {}
 
-    uint16_t get_start() { return _start; }
+    constexpr uint16_t get_start() const { return _start; }
 
-    uint16_t get_end() { return _end; }
+    constexpr uint16_t get_end() const { return _end; }
 
-    uint8_t get_length() { return _end - _start; }
+    constexpr uint8_t get_length() const { return _end - _start; }
 };
 
-Edge E[] {
+constexpr Edge E[] {
   Edge(0,21),
   Edge(22,35),
   Edge(36,48),
@@ -135,159 +358,181 @@ Edge E[] {
   Edge(377,391)
 };
 
+constexpr uint8_t EDGE_COUNT = sizeof(E) / sizeof(*E);
+constexpr uint8_t VERTEX_COUNT = 12;
+
+
+/** -----------------------------------------------------------------
+  VertexEdge
+
+  One edge end point at a vertex. The list below is the source of the whole
+  lamp topology, every edge has to appear exactly twice.
+*/
+#define EDGE_START true
+#define EDGE_END   false
+
+struct VertexEdge {
+  uint8_t vertex;                   // vertex index for V
+  uint8_t edge;                     // edge index for E
+  bool start;                       // EDGE_START or EDGE_END of the edge
+};
+
+constexpr VertexEdge VERTEX_EDGES[] {
+  {0, 0, EDGE_END}, {0, 1, EDGE_START}, {0, 24, EDGE_END},
+  {1, 19, EDGE_END}, {1, 20, EDGE_START}, {1, 23, EDGE_END}, {1, 24, EDGE_START},
+  {2, 15, EDGE_END}, {2, 16, EDGE_START}, {2, 18, EDGE_END}, {2, 19, EDGE_START},
+  {3, 13, EDGE_END}, {3, 14, EDGE_START}, {3, 15, EDGE_START},
+  {4, 1, EDGE_END}, {4, 2, EDGE_START}, {4, 4, EDGE_END}, {4, 5, EDGE_START}, {4, 22, EDGE_END}, {4, 23, EDGE_START},
+  {5, 17, EDGE_END}, {5, 18, EDGE_START}, {5, 20, EDGE_END}, {5, 21, EDGE_START}, {5, 22, EDGE_START},
+  {6, 9, EDGE_END}, {6, 10, EDGE_START}, {6, 12, EDGE_END}, {6, 13, EDGE_START}, {6, 16, EDGE_END}, {6, 17, EDGE_START},
+  {7, 5, EDGE_END}, {7, 6, EDGE_START}, {7, 8, EDGE_END}, {7, 9, EDGE_START}, {7, 21, EDGE_END},
+  {8, 0, EDGE_START}, {8, 2, EDGE_END}, {8, 3, EDGE_START},
+  {9, 3, EDGE_END}, {9, 4, EDGE_START}, {9, 6, EDGE_END}, {9, 7, EDGE_START},
+  {10, 7, EDGE_END}, {10, 8, EDGE_START}, {10, 10, EDGE_END}, {10, 11, EDGE_START},
+  {11, 11, EDGE_END}, {11, 12, EDGE_START}, {11, 14, EDGE_END}
+};
+
+constexpr uint8_t VERTEX_EDGE_COUNT = sizeof(VERTEX_EDGES) / sizeof(*VERTEX_EDGES);
+static_assert(VERTEX_EDGE_COUNT == 2 * EDGE_COUNT, "every edge needs two end points");
+
+
+/** -----------------------------------------------------------------
+  LampTopology
+
+  Compile time adjacency tables of the lamp graph.
+
+  Vertex adjacency is stored in CSR form: the edge ends of vertex v are
+  entries vertex_offsets[v] to vertex_offsets[v + 1] (exclusive) of
+  vertex_edges, vertex_pixels and vertex_edge_starts.
+
+  Members:
+    vertex_offsets                  CSR row offsets per vertex
+    vertex_edges                    adjacent edge
+    vertex_pixels                   pixel of the edge at the vertex
+    vertex_edge_starts              true if the edge starts at the vertex
+    edge_vertices                   [start vertex, end vertex] per edge
+    edge_slots                      [start, end] CSR entry per edge
+    pixel_edge                      edge of every pixel
+    pixel_offset                    offset of every pixel from its edge start
+    pixel_vertex                    vertex of every pixel, -1 if none
+*/
+struct LampTopology {
+  uint8_t vertex_offsets[VERTEX_COUNT + 1];
+  uint8_t vertex_edges[VERTEX_EDGE_COUNT];
+  uint16_t vertex_pixels[VERTEX_EDGE_COUNT];
+  bool vertex_edge_starts[VERTEX_EDGE_COUNT];
+  uint8_t edge_vertices[EDGE_COUNT][2];
+  uint8_t edge_slots[EDGE_COUNT][2];
+  uint8_t pixel_edge[NUM_LEDs];
+  uint8_t pixel_offset[NUM_LEDs];
+  int8_t pixel_vertex[NUM_LEDs];
+};
+
+constexpr LampTopology make_lamp_topology()
+{
+  LampTopology t {};
+
+  // CSR offsets: count edge ends per vertex, then accumulate
+  for (uint8_t i = 0; i < VERTEX_EDGE_COUNT; i++) {
+    t.vertex_offsets[VERTEX_EDGES[i].vertex + 1]++;
+  }
+  for (uint8_t v = 0; v < VERTEX_COUNT; v++) {
+    t.vertex_offsets[v + 1] += t.vertex_offsets[v];
+  }
+
+  // per-pixel edge tables
+  for (uint8_t e = 0; e < EDGE_COUNT; e++) {
+    for (uint16_t p = E[e].get_start(); p <= E[e].get_end(); p++) {
+      t.pixel_edge[p] = e;
+      t.pixel_offset[p] = p - E[e].get_start();
+      t.pixel_vertex[p] = -1;
+    }
+  }
+
+  // CSR entries
+  uint8_t filled[VERTEX_COUNT] {};
+  for (uint8_t i = 0; i < VERTEX_EDGE_COUNT; i++) {
+    const VertexEdge& ve = VERTEX_EDGES[i];
+    uint8_t k = t.vertex_offsets[ve.vertex] + filled[ve.vertex]++;
+    uint16_t pixel = ve.start ? E[ve.edge].get_start() : E[ve.edge].get_end();
+    t.vertex_edges[k] = ve.edge;
+    t.vertex_pixels[k] = pixel;
+    t.vertex_edge_starts[k] = ve.start;
+    t.edge_vertices[ve.edge][ve.start ? 0 : 1] = ve.vertex;
+    t.edge_slots[ve.edge][ve.start ? 0 : 1] = k;
+    t.pixel_vertex[pixel] = ve.vertex;
+  }
+  return t;
+}
+
+constexpr LampTopology TOPOLOGY = make_lamp_topology();
+
+/* per-pixel lookups */
+inline uint8_t pixel_edge(uint16_t pixel) { return TOPOLOGY.pixel_edge[pixel]; }
+inline uint8_t pixel_edge_offset(uint16_t pixel) { return TOPOLOGY.pixel_offset[pixel]; }
+inline int8_t pixel_vertex(uint16_t pixel) { return TOPOLOGY.pixel_vertex[pixel]; }
+
+/* per-edge lookups */
+inline uint8_t edge_vertex(uint8_t edge, bool start) { return TOPOLOGY.edge_vertices[edge][start ? 0 : 1]; }
+inline uint8_t edge_slot(uint8_t edge, bool start) { return TOPOLOGY.edge_slots[edge][start ? 0 : 1]; }
+
 
 /** -----------------------------------------------------------------
   Vertex
 
   Description of a vertex inside the lamp.
-  A vertex consists of end points of multiple edges.
+  A vertex consists of end points of multiple edges. It is a view onto the
+  TOPOLOGY tables, so nothing is allocated or copied.
 */
 class Vertex
 {
   private:
-    vector<uint8_t> _edge_indices;  // adjacent edges indixes for E
-    vector<uint16_t> _pixels;        // pixel on edge and vertex
-    uint8_t _size;                  // amount of adjacent edges
+    uint8_t _index;                 // vertex index for V
 
   public:
-    Vertex() : _size(0) {}
-
-    /**
-      addEdge
-
-      Add a new edge point to the vertex.
-
-      Parameters:
-        Edge e                      Edge object
-        bool start                  true: add edge start, else end
-    */
-    void add(uint8_t e, bool start)
-    {
-      _edge_indices.push_back(e);
-      _pixels.push_back(start ? E[e].get_start() : E[e].get_end());
-      _size++;
-    }
-
-    /* getter */
-    vector<uint8_t> get_edges() { return _edge_indices; }
-    vector<uint16_t> get_indices() { return _pixels; }
-    uint8_t get_size() { return _size; }
+    constexpr Vertex(uint8_t index) : _index(index) {}
+
+    /* adjacent edge indices for E */
+    const uint8_t* get_edges() const { return TOPOLOGY.vertex_edges + TOPOLOGY.vertex_offsets[_index]; }
+    /* pixels on edge and vertex */
+    const uint16_t* get_indices() const { return TOPOLOGY.vertex_pixels + TOPOLOGY.vertex_offsets[_index]; }
+    /* true if the adjacent edge starts at this vertex */
+    const bool* get_edge_starts() const { return TOPOLOGY.vertex_edge_starts + TOPOLOGY.vertex_offsets[_index]; }
+    /* amount of adjacent edges */
+    uint8_t get_size() const { return TOPOLOGY.vertex_offsets[_index + 1] - TOPOLOGY.vertex_offsets[_index]; }
 };
 
+constexpr Vertex V[VERTEX_COUNT] {
+  Vertex(0), Vertex(1), Vertex(2), Vertex(3), Vertex(4), Vertex(5),
+  Vertex(6), Vertex(7), Vertex(8), Vertex(9), Vertex(10), Vertex(11)
+};
 
-Vertex V[12];
-
-#define EDGE_START true
-#define EDGE_END   false
 
 /**
   init_lamp
 
-  Initialize the lamp parameters. This only includes vertex initialization as
-  they are weird to work with. My current C++ knowledge does not allow me to
-  do it elegantly else.
+  Initialize the lamp parameters. Edges, vertices and coordinate tables are
+  computed at compile time, only the projections are sorted here.
 */
 void init_lamp() {
-  V[0] = Vertex();
-  V[0].add(0, EDGE_END);
-  V[0].add(1, EDGE_START);
-  V[0].add(24, EDGE_END);
-
-  V[1] = Vertex();
-  V[1].add(19, EDGE_END);
-  V[1].add(20, EDGE_START);
-  V[1].add(23, EDGE_END);
-  V[1].add(24, EDGE_START);
-
-  V[2] = Vertex();
-  V[2].add(15, EDGE_END);
-  V[2].add(16, EDGE_START);
-  V[2].add(18, EDGE_END);
-  V[2].add(19, EDGE_START);
-
-  V[3] = Vertex();
-  V[3].add(13, EDGE_END);
-  V[3].add(14, EDGE_START);
-  V[3].add(15, EDGE_START);
-
-  V[4] = Vertex();
-  V[4].add(1, EDGE_END);
-  V[4].add(2, EDGE_START);
-  V[4].add(4, EDGE_END);
-  V[4].add(5, EDGE_START);
-  V[4].add(22, EDGE_END);
-  V[4].add(23, EDGE_START);
-
-  V[5] = Vertex();
-  V[5].add(17, EDGE_END);
-  V[5].add(18, EDGE_START);
-  V[5].add(20, EDGE_END);
-  V[5].add(21, EDGE_START);
-  V[5].add(22, EDGE_START);
-
-  V[6] = Vertex();
-  V[6].add(9, EDGE_END);
-  V[6].add(10, EDGE_START);
-  V[6].add(12, EDGE_END);
-  V[6].add(13, EDGE_START);
-  V[6].add(16, EDGE_END);
-  V[6].add(17, EDGE_START);
-
-  V[7] = Vertex();
-  V[7].add(5, EDGE_END);
-  V[7].add(6, EDGE_START);
-  V[7].add(8, EDGE_END);
-  V[7].add(9, EDGE_START);
-  V[7].add(21, EDGE_END);
-
-  V[8] = Vertex();
-  V[8].add(0, EDGE_START);
-  V[8].add(2, EDGE_END);
-  V[8].add(3, EDGE_START);
-
-  V[9] = Vertex();
-  V[9].add(3, EDGE_END);
-  V[9].add(4, EDGE_START);
-  V[9].add(6, EDGE_END);
-  V[9].add(7, EDGE_START);
-
-  V[10] = Vertex();
-  V[10].add(7, EDGE_END);
-  V[10].add(8, EDGE_START);
-  V[10].add(10, EDGE_END);
-  V[10].add(11, EDGE_START);
-
-  V[11] = Vertex();
-  V[11].add(11, EDGE_END);
-  V[11].add(12, EDGE_START);
-  V[11].add(14, EDGE_END);
+  PROJ_X.build(1, 0);
+  PROJ_Y.build(0, 1);
+  PROJ_SUM.build(1, 1);
+  PROJ_DIFF.build(1, -1);
+  PROJ_RADIUS.build_by(pixel_radius);
 }
 
 
 /**----------------------------------------------------------------------------
   get_vertex_index_of
 
-  Get the vertex that a given pixel s a part of.
-  It is assumed that a vertex can be uniquely identified by a pixel that it
-  contains.
-  
+  Get the vertex that a given pixel is a part of.
+  A vertex can be uniquely identified by a pixel that it contains.
+
   Returns:
     -1                              if no vertex is associated to the pixel
     vertex index for V              otherwise
 */
-int8_t get_vertex_index_of(uint16_t pixel) {
-  uint8_t vert_size;
-  vector<uint16_t> local_pixels;
-  // loop over all vertices
-  for (uint8_t i = 0; i < ARRAY_SIZE(V); i++) {
-    vert_size = V[i].get_size();
-    local_pixels = V[i].get_indices();
-    // loop over vertex pixels
-    for (uint8_t e = 0; e < vert_size; e++) {
-      if (local_pixels[e] == pixel)
-        return local_pixels[e];
-    }
-  }
-  return -1;
+inline int8_t get_vertex_index_of(uint16_t pixel) {
+  return pixel < NUM_LEDs ? pixel_vertex(pixel) : -1;
 }
-
@@ -0,0 +1,211 @@
+/** ===========================================================================
+  profiler.h
+
+  This file contains a lightweight profiler for the hot path of the lamp.
+  Scoped timers record the duration of a stage into a fixed ring buffer in
+  RAM. Recording neither allocates nor prints, so it can stay enabled in
+  normal operation. Statistics are only computed and printed on request
+  from the serial console:
+
+    p                               print min, mean, p99 and max per stage
+                                    and animation
+    r                               reset the recorded samples
+
+  Samples are single 32 bit words, so the output task on the other core can
+  record into the same buffer without tearing.
+*/
+
+#pragma once
+
+#include <atomic>
+#include <algorithm>
+#include <inttypes.h>
+
+extern uint8_t ACTIVE_ANIMATION;
+
+/* profiled stages */
+#define STAGE_INPUTS      0   // update_inputs()
+#define STAGE_UPDATE      1   // Animation::update()
+#define STAGE_DRAW        2   // Animation::draw()
+#define STAGE_TRANSITION  3   // animation_transition()
+#define STAGE_MILLIAMPS   4   // calculate_milliamps()
+#define STAGE_SHOW        5   // strip.Show()
+#define STAGE_COUNT       6
+
+const char* const STAGE_NAMES[STAGE_COUNT] = {
+  "inputs", "update", "draw", "transition", "milliamps", "show"
+};
+
+#define PROFILE_SAMPLES 1024        // ring buffer size, divides 2^16
+#define PROFILE_ANIMATIONS 32       // animations that can be told apart
+
+/* sample layout */
+#define SAMPLE_VALID      0x80000000u
+#define SAMPLE_STAGE(s)   (((s) >> 26) & 0x1f)
+#define SAMPLE_ANIM(s)    (((s) >> 21) & 0x1f)
+#define SAMPLE_US(s)      ((s) & 0x1fffff)
+#define SAMPLE_MAX_US     0x1fffff  // ~2 s, longer durations are clipped
+
+/** -----------------------------------------------------------------
+  ProfileStats
+
+  Duration statistics of one stage and animation [us].
+*/
+struct ProfileStats
+{
+  uint16_t count;
+  uint32_t min, mean, p99, max;
+};
+
+/** -----------------------------------------------------------------
+  Profiler
+
+  Ring buffer of the last PROFILE_SAMPLES stage durations. Every sample is
+  tagged with the stage and the animation active when it was recorded.
+*/
+class Profiler
+{
+  static_assert(65536 % PROFILE_SAMPLES == 0, "head must wrap with the ring buffer");
+
+  private:
+    std::atomic<uint32_t> _samples[PROFILE_SAMPLES];
+    std::atomic<uint16_t> _head;    // next sample to write
+
+  public:
+    Profiler() { reset(); }
+
+    void reset()
+    {
+      for (uint16_t i = 0; i < PROFILE_SAMPLES; i++) {
+        _samples[i].store(0, std::memory_order_relaxed);
+      }
+      _head.store(0, std::memory_order_relaxed);
+    }
+
+    /* record a duration, overwriting the oldest sample */
+    void record(uint8_t stage, uint32_t us, uint8_t animation = ACTIVE_ANIMATION)
+    {
+      uint16_t slot = _head.fetch_add(1, std::memory_order_relaxed) % PROFILE_SAMPLES;
+      _samples[slot].store(SAMPLE_VALID
+                           | ((uint32_t) stage << 26)
+                           | ((uint32_t) (animation % PROFILE_ANIMATIONS) << 21)
+                           | min(us, (uint32_t) SAMPLE_MAX_US),
+                           std::memory_order_relaxed);
+    }
+
+    /**
+      stats
+
+      Statistics of the recorded samples of a stage and animation.
+
+      Parameters:
+        uint8_t stage               STAGE_*
+        uint8_t animation           animation index
+        ProfileStats& out           computed statistics
+
+      Returns:
+        bool                        false if there are no samples.
+    */
+    bool stats(uint8_t stage, uint8_t animation, ProfileStats& out) const
+    {
+      static uint32_t durations[PROFILE_SAMPLES];
+      uint16_t count = 0;
+      uint64_t sum = 0;
+
+      for (uint16_t i = 0; i < PROFILE_SAMPLES; i++) {
+        uint32_t sample = _samples[i].load(std::memory_order_relaxed);
+        if (!(sample & SAMPLE_VALID) || SAMPLE_STAGE(sample) != stage ||
+            SAMPLE_ANIM(sample) != animation % PROFILE_ANIMATIONS)
+          continue;
+        durations[count++] = SAMPLE_US(sample);
+        sum += SAMPLE_US(sample);
+      }
+      if (count == 0)
+        return false;
+
+      uint32_t* end = durations + count;
+      out.count = count;
+      out.mean = sum / count;
+      out.min = *std::min_element(durations, end);
+      out.max = *std::max_element(durations, end);
+      uint32_t* p99 = durations + (count - 1) * 99 / 100;
+      std::nth_element(durations, p99, end);
+      out.p99 = *p99;
+      return true;
+    }
+
+    /* print the statistics of all stages and animations with samples */
+    void dump() const
+    {
+      ProfileStats s;
+      Serial.printf("%-11s %4s %6s %8s %8s %8s %8s\n",
+                    "stage", "anim", "count", "min", "mean", "p99", "max");
+      for (uint8_t stage = 0; stage < STAGE_COUNT; stage++) {
+        for (uint8_t anim = 0; anim < PROFILE_ANIMATIONS; anim++) {
+          if (!stats(stage, anim, s))
+            continue;
+          Serial.printf("%-11s %4u %6u %8" PRIu32 " %8" PRIu32 " %8" PRIu32 " %8" PRIu32 "\n",
+                        STAGE_NAMES[stage], anim, s.count, s.min, s.mean, s.p99, s.max);
+        }
+      }
+    }
+};
+
+extern Profiler PROFILER;
+
+
+
+/** -----------------------------------------------------------------
+  ScopedTimer
+
+  Records the time from construction to destruction as a stage duration.
+  Use PROFILE(stage) at the top of a block instead of constructing it
+  directly, so profiling can be compiled out with PROFILING.
+*/
+class ScopedTimer
+{
+  private:
+    uint8_t _stage;
+    uint32_t _start;
+
+  public:
+    ScopedTimer(uint8_t stage) :
+      _stage(stage),
+      _start(micros())
+    {}
+
+    ~ScopedTimer() { PROFILER.record(_stage, micros() - _start); }
+};
+
+#if PROFILING
+#define PROFILE(stage) ScopedTimer _scoped_timer(stage)
+#else
+#define PROFILE(stage)
+#endif
+
+
+
+/**----------------------------------------------------------------------------
+  profiler_command
+
+  Handle a profiler command from the serial console.
+  Only ever prints when a command was received.
+
+  Parameters:
+    char command                    received command
+
+  Returns:
+    bool                            true if it was a profiler command.
+*/
+bool profiler_command(char command) {
+  switch (command) {
+    case 'p':
+      PROFILER.dump();
+      return true;
+    case 'r':
+      PROFILER.reset();
+      Serial.println("Profiler reset");
+      return true;
+  }
+  return false;
+}
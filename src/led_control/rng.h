@@ -0,0 +1,124 @@
+/** ===========================================================================
+  rng.h
+
+  This file contains Rng, a small pseudo random number generator (PCG32,
+  8 bytes of state). Every animation owns one, so random heavy effects
+  neither share one generator nor pay for Arduino's random(), which costs a
+  library call and a modulo per number.
+
+  Bounded numbers use a multiply and a shift instead of a modulo and
+  reject the few values that would bias the result. fill() draws two
+  bounded bytes per generator step for per-pixel randomness.
+
+  The generators of all animations are seeded from RNG, which is seeded
+  once at boot, and again when an input trace is recorded or replayed
+  (see input_trace.h). Everything random therefore repeats from one seed.
+*/
+
+#pragma once
+
+#define RNG_MULTIPLIER 6364136223846793005ull   // LCG multiplier of PCG32
+#define RNG_INCREMENT ((54ull << 1) | 1)        // stream of all generators
+
+/** -----------------------------------------------------------------
+  Rng
+
+  PCG32 (XSH RR variant) on a single stream.
+*/
+class Rng
+{
+  private:
+    uint64_t _state;
+
+    /* bounded value from 16 random bits, rejected ones are drawn again */
+    inline uint8_t _below16(uint32_t bits, uint16_t range, uint16_t threshold)
+    {
+      uint32_t m = bits * range;
+      if ((m & 0xffff) < threshold)
+        return below(range);
+      return m >> 16;
+    }
+
+  public:
+    Rng(uint32_t seed = 0) { this->seed(seed); }
+
+    /* restart the sequence of a seed */
+    void seed(uint32_t seed)
+    {
+      _state = 0;
+      next();
+      _state += seed;
+      next();
+    }
+
+    /* next 32 random bits */
+    inline uint32_t next()
+    {
+      uint64_t old = _state;
+      _state = old * RNG_MULTIPLIER + RNG_INCREMENT;
+      uint32_t xorshifted = ((old >> 18) ^ old) >> 27;
+      uint32_t rot = old >> 59;
+      return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+    }
+
+    /**
+      below
+
+      Uniform random number in [0, range), without modulo bias.
+
+      Parameters:
+        uint32_t range              amount of possible values, 0 returns 0
+
+      Returns:
+        uint32_t                    random number.
+    */
+    inline uint32_t below(uint32_t range)
+    {
+      uint64_t m = (uint64_t) next() * range;
+      uint32_t low = m;
+      if (low < range) {
+        // 2^32 % range values of low would favor some results
+        uint32_t threshold = -range % range;
+        while (low < threshold) {
+          m = (uint64_t) next() * range;
+          low = m;
+        }
+      }
+      return m >> 32;
+    }
+
+    /* uniform random number in [lower, upper), lower if the range is empty */
+    inline int32_t between(int32_t lower, int32_t upper)
+    {
+      return upper > lower ? lower + (int32_t) below(upper - lower) : lower;
+    }
+
+    /**
+      fill
+
+      Fill an array with uniform random bytes in [lower, upper), without
+      modulo bias. Every generator step yields two values, a rejected one
+      (less than 1 in 256) is replaced by an unbiased below().
+
+      Parameters:
+        uint8_t* values             array to fill
+        uint16_t count              amount of values
+        uint8_t lower               lower boundary, included
+        uint8_t upper               upper boundary, excluded
+    */
+    void fill(uint8_t* values, uint16_t count, uint8_t lower, uint8_t upper)
+    {
+      uint16_t range = upper > lower ? upper - lower : 1;
+      uint16_t threshold = 65536 % range;
+      uint16_t i = 0;
+      for (; i + 1 < count; i += 2) {
+        uint32_t bits = next();
+        values[i] = lower + _below16(bits & 0xffff, range, threshold);
+        values[i + 1] = lower + _below16(bits >> 16, range, threshold);
+      }
+      if (i < count)
+        values[i] = lower + _below16(next() & 0xffff, range, threshold);
+    }
+};
+
+extern Rng RNG;
@@ -0,0 +1,437 @@
+/** ===========================================================================
+  shader.h
+
+  This file contains per-pixel shader kernels. Effects that are a function
+  of the lamp coordinates (see LampTables in pixels.h) are written as a
+  composition of small kernels instead of a hand-written loop:
+    using namespace shader;
+    setShader(
+      gradient(RgbwColor(255, 0, 0, 0), RgbwColor(0, 0, 255, 0), coord_u()),
+      target
+    );
+
+  Every kernel is a small struct that computes the value of one pixel, and
+  combining kernels nests their types. The whole expression is one type
+  known at compile time, so setShader() and its relatives compile it into a
+  single loop over the coordinate tables, without virtual calls and without
+  intermediate buffers between the stages.
+
+  Kernels return one of these values:
+    int32_t coordinate              raw lamp coordinates and sums of them
+    int32_t unit: [0,65535]         normalized coordinates, angles, waves
+    int32_t level: [0,255]          intensities, e.g. of a band
+    int32_t hue: [0,HUE_STEPS)      hues, see HsvColor
+    PackedColor color               pixel colors
+
+  Numbers and RgbwColors given to a kernel are constants for all pixels.
+*/
+
+#pragma once
+
+#include <type_traits>
+
+#include "pixels.h"
+#include "led_functions.h"
+#include "utils.h"
+
+/**----------------------------------------------------------------------------
+  wave16
+
+  Sine of a phase in fixed point, from Bhaskara's approximation. Results
+  are within 0.2% of the full range of the exact sine.
+
+  Parameters:
+    uint16_t phase                  a full turn is 65536
+
+  Returns:
+    uint16_t: [1,65535]             (sin + 1) / 2 * 65535
+*/
+inline uint16_t wave16(uint16_t phase) {
+  uint32_t x = phase & 0x7fff;                  // phase in the half turn
+  uint32_t q = (x * (32768 - x)) >> 14;         // [0,16384]
+  uint32_t y = min((q << 17) / (5 * 16384 - q), (uint32_t) 32767);
+  return phase & 0x8000 ? 32768 - y : 32768 + y;
+}
+
+
+
+namespace shader {
+
+/* ========================================================================= */
+/* constants */
+
+template<class T>
+struct Constant {
+  T value;
+
+  inline T operator()(uint16_t pixel) const { return value; }
+};
+
+/* wrap constants into kernels, kernels are passed through */
+template<class T>
+inline auto as_kernel(T value) {
+  if constexpr (std::is_arithmetic<T>::value)
+    return Constant<int32_t> {(int32_t) value};
+  else
+    return value;
+}
+
+inline Constant<PackedColor> as_kernel(RgbwColor color) {
+  return {pack(color)};
+}
+
+template<class T>
+using Kernel = decltype(as_kernel(std::declval<T>()));
+
+
+
+/* ========================================================================= */
+/* coordinates */
+
+/* a column of LAMP */
+struct Coordinate {
+  const uint16_t* table;
+
+  inline int32_t operator()(uint16_t pixel) const { return table[pixel]; }
+};
+
+/* raw coordinates */
+inline Coordinate coord_x() { return {LAMP.x}; }
+inline Coordinate coord_y() { return {LAMP.y}; }
+inline Coordinate coord_radius() { return {LAMP.radius}; }
+
+/* units */
+inline Coordinate coord_u() { return {LAMP.u}; }
+inline Coordinate coord_v() { return {LAMP.v}; }
+inline Coordinate coord_angle() { return {LAMP.angle}; }
+
+/* x_fac * x + y_fac * y, the key of Projection::build() */
+struct Linear {
+  int8_t x_fac, y_fac;
+
+  inline int32_t operator()(uint16_t pixel) const
+  {
+    return x_fac * LAMP.x[pixel] + y_fac * LAMP.y[pixel];
+  }
+};
+
+inline Linear coord_linear(int8_t x_fac, int8_t y_fac) { return {x_fac, y_fac}; }
+
+
+
+/* ========================================================================= */
+/* scalar functions */
+
+/* a + b */
+template<class A, class B>
+struct Sum {
+  A a;
+  B b;
+
+  inline int32_t operator()(uint16_t pixel) const { return a(pixel) + b(pixel); }
+};
+
+template<class A, class B>
+inline Sum<Kernel<A>, Kernel<B>> sum(A a, B b) {
+  return {as_kernel(a), as_kernel(b)};
+}
+
+/* a unit scaled to [0,range), e.g. a hue from coord_u() */
+template<class UNIT>
+struct Fraction {
+  UNIT unit;
+  uint32_t range;
+
+  inline int32_t operator()(uint16_t pixel) const
+  {
+    return ((uint32_t) unit(pixel) * range) >> 16;
+  }
+};
+
+template<class UNIT>
+inline Fraction<Kernel<UNIT>> fraction(UNIT unit, uint32_t range) {
+  return {as_kernel(unit), range};
+}
+
+/**----------------------------------------------------------------------------
+  wave
+
+  Sine wave along a coordinate, as a unit.
+
+  Parameters:
+    COORDINATE coordinate           position along the wave
+    int32_t frequency               turns per coordinate step, in 1/65536
+    int32_t phase                   offset of the wave, a full turn is 65536
+*/
+template<class COORDINATE>
+struct Wave {
+  COORDINATE coordinate;
+  int32_t frequency;
+  int32_t phase;
+
+  inline int32_t operator()(uint16_t pixel) const
+  {
+    return wave16(coordinate(pixel) * frequency + phase);
+  }
+};
+
+template<class COORDINATE>
+inline Wave<Kernel<COORDINATE>> wave(COORDINATE coordinate, int32_t frequency, int32_t phase) {
+  return {as_kernel(coordinate), frequency, phase};
+}
+
+/**----------------------------------------------------------------------------
+  band
+
+  Level of a band around a center, 255 at the center and falling linearly
+  to 0 at a distance of width.
+
+  Parameters:
+    VALUE value                     kernel, e.g. a coordinate
+    CENTER center                   center of the band, can be a kernel
+    int32_t width                   half width of the band
+*/
+template<class VALUE, class CENTER>
+struct Band {
+  VALUE value;
+  CENTER center;
+  int32_t width;
+
+  inline int32_t operator()(uint16_t pixel) const
+  {
+    int32_t dist = abs(value(pixel) - center(pixel));
+    return dist < width ? 255 * (width - dist) / width : 0;
+  }
+};
+
+template<class VALUE, class CENTER>
+inline Band<Kernel<VALUE>, Kernel<CENTER>> band(VALUE value, CENTER center, int32_t width) {
+  return {as_kernel(value), as_kernel(center), width};
+}
+
+
+
+/* ========================================================================= */
+/* colors */
+
+/**----------------------------------------------------------------------------
+  hue_map
+
+  Color from a hue, saturation and value, see Hsvw2Rgbw(). Hues wrap
+  around, pixels with a value of 0 are black.
+
+  Parameters:
+    HUE hue                         hue, not negative
+    SATURATION saturation           level
+    VALUE value                     level
+*/
+template<class HUE, class SATURATION, class VALUE>
+struct HueMap {
+  HUE hue;
+  SATURATION saturation;
+  VALUE value;
+
+  inline PackedColor operator()(uint16_t pixel) const
+  {
+    uint8_t v = value(pixel);
+    if (v == 0)
+      return 0;
+    return pack(Hsvw2Rgbw((uint16_t) ((uint32_t) hue(pixel) % HUE_STEPS), saturation(pixel), v, 0));
+  }
+};
+
+template<class HUE, class SATURATION, class VALUE>
+inline HueMap<Kernel<HUE>, Kernel<SATURATION>, Kernel<VALUE>> hue_map(HUE hue, SATURATION saturation, VALUE value) {
+  return {as_kernel(hue), as_kernel(saturation), as_kernel(value)};
+}
+
+/**----------------------------------------------------------------------------
+  gradient
+
+  Linear interpolation between two colors, per channel like lerp8().
+
+  Parameters:
+    A a                             color at t = 0
+    B b                             color at t = 65535
+    T t                             unit
+*/
+template<class A, class B, class T>
+struct Gradient {
+  A a;
+  B b;
+  T t;
+
+  inline PackedColor operator()(uint16_t pixel) const
+  {
+    PackedColor from = a(pixel), to = b(pixel);
+    uint16_t fac = t(pixel);
+    return (PackedColor) lerp8(from, to, fac)
+           | (PackedColor) lerp8(from >> 8, to >> 8, fac) << 8
+           | (PackedColor) lerp8(from >> 16, to >> 16, fac) << 16
+           | (PackedColor) lerp8(from >> 24, to >> 24, fac) << 24;
+  }
+};
+
+template<class A, class B, class T>
+inline Gradient<Kernel<A>, Kernel<B>, Kernel<T>> gradient(A a, B b, T t) {
+  return {as_kernel(a), as_kernel(b), as_kernel(t)};
+}
+
+/* color scaled by a level, see packed_scale() */
+template<class COLOR, class LEVEL>
+struct Scale {
+  COLOR color;
+  LEVEL level;
+
+  inline PackedColor operator()(uint16_t pixel) const
+  {
+    return packed_scale(color(pixel), level(pixel));
+  }
+};
+
+template<class COLOR, class LEVEL>
+inline Scale<Kernel<COLOR>, Kernel<LEVEL>> scale(COLOR color, LEVEL level) {
+  return {as_kernel(color), as_kernel(level)};
+}
+
+/* color with all channels reduced by a level, see fadeToBlackBy() */
+template<class COLOR, class LEVEL>
+struct Fade {
+  COLOR color;
+  LEVEL level;
+
+  inline PackedColor operator()(uint16_t pixel) const
+  {
+    return packed_sub(color(pixel), packed_splat(level(pixel)));
+  }
+};
+
+template<class COLOR, class LEVEL>
+inline Fade<Kernel<COLOR>, Kernel<LEVEL>> fade(COLOR color, LEVEL level) {
+  return {as_kernel(color), as_kernel(level)};
+}
+
+/* saturating sum of two colors */
+template<class A, class B>
+struct Add {
+  A a;
+  B b;
+
+  inline PackedColor operator()(uint16_t pixel) const { return packed_add(a(pixel), b(pixel)); }
+};
+
+template<class A, class B>
+inline Add<Kernel<A>, Kernel<B>> add(A a, B b) {
+  return {as_kernel(a), as_kernel(b)};
+}
+
+/* src blended onto dst, see blend() in packed_color.h */
+template<class DST, class SRC>
+struct Blend {
+  uint8_t mode;
+  uint8_t opacity;
+  DST dst;
+  SRC src;
+
+  inline PackedColor operator()(uint16_t pixel) const
+  {
+    return ::blend(mode, opacity, dst(pixel), src(pixel));
+  }
+};
+
+template<class DST, class SRC>
+inline Blend<Kernel<DST>, Kernel<SRC>> blend(uint8_t mode, DST dst, SRC src, uint8_t opacity = 255) {
+  return {mode, opacity, as_kernel(dst), as_kernel(src)};
+}
+
+/* the color a buffer had before, for effects that build on their last frame */
+struct Previous {
+  const PixelBuffer* buffer;
+
+  inline PackedColor operator()(uint16_t pixel) const { return buffer->get_packed(pixel); }
+};
+
+inline Previous previous(const PixelBuffer& buffer) { return {&buffer}; }
+
+
+
+/* ========================================================================= */
+/* custom functions */
+
+/* any function of the value of a kernel, e.g. a lambda */
+template<class VALUE, class FUNCTION>
+struct Map {
+  VALUE value;
+  FUNCTION function;
+
+  inline auto operator()(uint16_t pixel) const { return function(value(pixel)); }
+};
+
+template<class VALUE, class FUNCTION>
+inline Map<Kernel<VALUE>, FUNCTION> map(VALUE value, FUNCTION function) {
+  return {as_kernel(value), function};
+}
+
+}   // namespace shader
+
+
+
+/* ========================================================================= */
+/* shading */
+
+/**----------------------------------------------------------------------------
+  setShader
+
+  Set every pixel to the color of a kernel.
+
+  Parameters:
+    KERNEL kernel                   color kernel
+    PixelBuffer& buffer (optional)  buffer to write to
+*/
+template<class KERNEL>
+void setShader(const KERNEL& kernel, PixelBuffer& buffer = framebuffer) {
+  for (uint16_t i = 0; i < NUM_LEDs; i++) {
+    buffer.set_packed(i, kernel(i));
+  }
+}
+
+
+
+/**----------------------------------------------------------------------------
+  setShaderMasked
+
+  Set all pixels of a mask to the color of a kernel, leaving all other
+  pixels as they are.
+
+  Parameters:
+    const PixelMask& mask           pixels to set
+    KERNEL kernel                   color kernel
+    PixelBuffer& buffer (optional)  buffer to write to
+*/
+template<class KERNEL>
+void setShaderMasked(const PixelMask& mask, const KERNEL& kernel, PixelBuffer& buffer = framebuffer) {
+  mask.for_each([&](uint16_t pixel) {
+    buffer.set_packed(pixel, kernel(pixel));
+  });
+}
+
+
+
+/**----------------------------------------------------------------------------
+  addShader
+
+  Add the color of a kernel to the pixels of a span, e.g. of a band query
+  of a Projection, so only the lit pixels are shaded.
+
+  Parameters:
+    const PixelSpan& span           pixels to add to
+    KERNEL kernel                   color kernel
+    PixelBuffer& buffer (optional)  buffer to write to
+*/
+template<class KERNEL>
+void addShader(const PixelSpan& span, const KERNEL& kernel, PixelBuffer& buffer = framebuffer) {
+  for (uint16_t i = 0; i < span.count; i++) {
+    uint16_t pixel = span.pixels[i];
+    buffer.set_packed(pixel, packed_add(buffer.get_packed(pixel), kernel(pixel)));
+  }
+}
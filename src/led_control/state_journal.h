@@ -0,0 +1,354 @@
+/** ===========================================================================
+  state_journal.h
+
+  This file contains the state journal, which keeps the state that survives
+  a power cycle (e.g. the active animation) in a flash partition.
+
+  The render path only changes values in RAM. A low priority task on
+  core 0 writes them once they did not change for JOURNAL_COALESCE
+  milliseconds, so clicking through a few animations costs a single write.
+
+  Flash work still reaches the frame loop on the ESP32: while the flash is
+  programmed or erased, its cache is disabled on both cores, so loop() on
+  core 1 stalls as well. Programming a record takes well below a
+  millisecond. Erasing a sector on rotation, once per JOURNAL_SLOTS writes,
+  typically stalls for ~45 ms and can take up to ~300 ms on slow flash
+  chips, i.e. one to a dozen dropped frames.
+
+  On flash, the journal is a log: every write appends an 8 byte record to
+  the active sector, which only programs that record. Once the sector is
+  full, the journal moves on to the next sector of the partition and starts
+  it with a snapshot of all values. Erases are therefore spread over all
+  sectors, and there is one per JOURNAL_SLOTS writes at most.
+
+  Sector layout:
+    JournalHeader                   magic and sequence number
+    JournalRecord[JOURNAL_SLOTS]    records, unwritten ones are all 0xff
+
+  The header of a new sector is written after its snapshot, sequence number
+  first and magic last, and records carry a check byte, so a power loss
+  while writing leaves either the old sector or an ignored record behind.
+  On boot, the valid sector with the highest sequence number is replayed.
+
+  The partition is labeled "journal", see partitions.csv. The host uses a
+  stand-in of the partition API (see host/esp_partition.h).
+*/
+
+#pragma once
+
+#include <atomic>
+#include <stddef.h>
+
+#include <esp_partition.h>
+
+#define JOURNAL_LABEL "journal"     // label of the partition
+#define JOURNAL_SECTOR SPI_FLASH_SEC_SIZE   // erase unit
+#define JOURNAL_MAGIC 0x4c4e4a53    // "SJNL"
+#define JOURNAL_UNWRITTEN 0xffffffff    // erased flash word
+#define JOURNAL_COALESCE 2000       // ms without changes before writing
+#define JOURNAL_POLL 100            // ms between checks of the task
+#define JOURNAL_TASK_CORE 0         // core to write from
+#define JOURNAL_TASK_STACK 2048     // stack size of the journal task
+
+/* state keys */
+#define STATE_ANIMATION 0           // active animation
+#define STATE_KEYS 8                // amount of keys, at most 32
+
+/** -----------------------------------------------------------------
+  JournalHeader, JournalRecord
+
+  Flash structures of the journal, 8 bytes each.
+*/
+struct JournalHeader
+{
+  uint32_t magic;                   // JOURNAL_MAGIC once the sector is valid
+  uint32_t sequence;                // increases with every sector
+};
+
+struct JournalRecord
+{
+  uint8_t key;                      // STATE_* key
+  uint8_t check;                    // see journal_check()
+  uint16_t reserved;                // 0
+  uint32_t value;
+};
+
+#define JOURNAL_SLOTS ((JOURNAL_SECTOR - sizeof(JournalHeader)) / sizeof(JournalRecord))
+
+static_assert(STATE_KEYS <= 32 && STATE_KEYS < JOURNAL_SLOTS, "snapshot has to fit a sector");
+
+/* check byte of a record, never 0xff for valid keys and the erased value */
+inline uint8_t journal_check(uint8_t key, uint32_t value) {
+  return (key ^ value ^ (value >> 8) ^ (value >> 16) ^ (value >> 24) ^ 0x5a) & 0x7f;
+}
+
+
+
+/** -----------------------------------------------------------------
+  StateJournal
+
+  Journal of up to STATE_KEYS 32 bit values. set() and get() may be called
+  from loop(), flush() only from one task at a time.
+*/
+class StateJournal
+{
+  private:
+    const esp_partition_t* _partition;
+    uint8_t _sectors;               // sectors in the partition
+    uint8_t _sector;                // active sector
+    uint32_t _sequence;             // sequence number of the active sector
+    uint16_t _next;                 // next free slot of the active sector
+
+    std::atomic<uint32_t> _values[STATE_KEYS];
+    std::atomic<uint32_t> _present; // keys that have a value, one bit each
+    std::atomic<uint32_t> _dirty;   // keys changed since the last flush
+    std::atomic<uint32_t> _changed_at;  // millis() of the last change
+    uint32_t _writes;               // records written
+
+    /* flash offset of a slot */
+    uint32_t _slot_offset(uint8_t sector, uint16_t slot) const
+    {
+      return sector * JOURNAL_SECTOR + sizeof(JournalHeader) + slot * sizeof(JournalRecord);
+    }
+
+    /* write a record into a slot of a sector */
+    bool _write(uint8_t sector, uint16_t slot, uint8_t key)
+    {
+      uint32_t value = _values[key].load(std::memory_order_relaxed);
+      JournalRecord record = {key, journal_check(key, value), 0, value};
+      _writes++;
+      return esp_partition_write(_partition, _slot_offset(sector, slot), &record, sizeof(record)) == ESP_OK;
+    }
+
+    /* start the next sector with a snapshot of all values */
+    bool _rotate()
+    {
+      uint8_t sector = (_sector + 1) % _sectors;
+      if (esp_partition_erase_range(_partition, sector * JOURNAL_SECTOR, JOURNAL_SECTOR) != ESP_OK)
+        return false;
+
+      uint16_t slot = 0;
+      uint32_t present = _present.load(std::memory_order_relaxed);
+      for (uint8_t key = 0; key < STATE_KEYS; key++) {
+        if ((present >> key & 1) && !_write(sector, slot++, key))
+          return false;
+      }
+
+      // the sector only becomes valid with its magic, written last
+      JournalHeader header = {JOURNAL_MAGIC, _sequence + 1};
+      uint32_t offset = sector * JOURNAL_SECTOR;
+      if (esp_partition_write(_partition, offset + offsetof(JournalHeader, sequence),
+                              &header.sequence, sizeof(header.sequence)) != ESP_OK ||
+          esp_partition_write(_partition, offset + offsetof(JournalHeader, magic),
+                              &header.magic, sizeof(header.magic)) != ESP_OK)
+        return false;
+
+      _sector = sector;
+      _sequence++;
+      _next = slot;
+      return true;
+    }
+
+  public:
+    StateJournal() :
+      _partition(NULL),
+      _sectors(0),
+      _sector(0),
+      _sequence(0),
+      _next(0),
+      _present(0),
+      _dirty(0),
+      _changed_at(0),
+      _writes(0)
+    {
+      for (uint8_t key = 0; key < STATE_KEYS; key++) {
+        _values[key].store(0, std::memory_order_relaxed);
+      }
+    }
+
+    /**
+      begin
+
+      Load the journal from a partition. An empty partition is initialized.
+
+      Parameters:
+        const esp_partition_t* partition
+                                    partition of at least 2 sectors
+
+      Returns:
+        bool                        false if there is no usable partition,
+                                    values are then only kept in RAM.
+    */
+    bool begin(const esp_partition_t* partition)
+    {
+      if (!partition || partition->size / JOURNAL_SECTOR < 2)
+        return false;
+      _partition = partition;
+      _sectors = min(partition->size / JOURNAL_SECTOR, (uint32_t) 255);
+
+      // newest valid sector
+      bool found = false;
+      for (uint8_t s = 0; s < _sectors; s++) {
+        JournalHeader header;
+        if (esp_partition_read(partition, s * JOURNAL_SECTOR, &header, sizeof(header)) != ESP_OK)
+          continue;
+        // a torn header from before the sequence was written first has none
+        if (header.magic != JOURNAL_MAGIC || header.sequence == JOURNAL_UNWRITTEN)
+          continue;
+        if (!found || header.sequence > _sequence) {
+          found = true;
+          _sector = s;
+          _sequence = header.sequence;
+        }
+      }
+
+      if (!found) {
+        // start over at the last sector, so the first rotation erases sector 0
+        _sector = _sectors - 1;
+        _sequence = 0;
+        _next = JOURNAL_SLOTS;
+        _present.store(0);
+        return _rotate();
+      }
+
+      // replay the records of the sector
+      uint32_t present = 0;
+      for (_next = 0; _next < JOURNAL_SLOTS; _next++) {
+        JournalRecord record;
+        if (esp_partition_read(partition, _slot_offset(_sector, _next), &record, sizeof(record)) != ESP_OK)
+          return false;
+        if (record.key == 0xff && record.check == 0xff && record.value == 0xffffffff)
+          break;
+        // torn or unknown records are skipped
+        if (record.key < STATE_KEYS && record.check == journal_check(record.key, record.value)) {
+          _values[record.key].store(record.value, std::memory_order_relaxed);
+          present |= 1u << record.key;
+        }
+      }
+      _present.store(present);
+      return true;
+    }
+
+    /* stored value of a key, false if there is none */
+    bool get(uint8_t key, uint32_t& value) const
+    {
+      if (key >= STATE_KEYS || !(_present.load() >> key & 1))
+        return false;
+      value = _values[key].load(std::memory_order_relaxed);
+      return true;
+    }
+
+    /**
+      set
+
+      Change a value. Only RAM is touched, flush() writes it later. Setting
+      the stored value again does not cause a write.
+
+      Parameters:
+        uint8_t key                 STATE_* key
+        uint32_t value              new value
+    */
+    void set(uint8_t key, uint32_t value)
+    {
+      if (key >= STATE_KEYS)
+        return;
+      uint32_t bit = 1u << key;
+      if ((_present.load() & bit) && _values[key].load(std::memory_order_relaxed) == value)
+        return;
+      _values[key].store(value, std::memory_order_relaxed);
+      _present.fetch_or(bit);
+      _changed_at.store(millis(), std::memory_order_relaxed);
+      _dirty.fetch_or(bit);
+    }
+
+    /**
+      flush
+
+      Write all changed values. Values changed while flushing are written by
+      the next flush.
+
+      Returns:
+        bool                        false if writing failed, the values are
+                                    tried again next time.
+    */
+    bool flush()
+    {
+      uint32_t dirty = _dirty.exchange(0);
+      if (!_partition || !dirty)
+        return true;
+
+      for (uint8_t key = 0; key < STATE_KEYS; key++) {
+        if (!(dirty >> key & 1))
+          continue;
+        if (_next == JOURNAL_SLOTS) {
+          // the snapshot of the new sector holds every value
+          if (_rotate())
+            return true;
+          _dirty.fetch_or(dirty);
+          return false;
+        }
+        if (!_write(_sector, _next++, key)) {
+          _dirty.fetch_or(dirty);
+          return false;
+        }
+        dirty &= ~(1u << key);
+      }
+      return true;
+    }
+
+    /* flush once nothing changed for JOURNAL_COALESCE ms */
+    bool flush_when_idle()
+    {
+      if (!_dirty.load() || millis() - _changed_at.load(std::memory_order_relaxed) < JOURNAL_COALESCE)
+        return true;
+      return flush();
+    }
+
+    /* getter, flushing side only */
+    uint8_t get_sector() const { return _sector; }
+    uint32_t get_sequence() const { return _sequence; }
+    uint32_t get_writes() const { return _writes; }
+    bool is_dirty() const { return _dirty.load() != 0; }
+};
+
+extern StateJournal journal;
+
+
+
+/**----------------------------------------------------------------------------
+  journal_task
+
+  Body of the journal task: write changed values once they settled.
+*/
+void journal_task(void* param) {
+  for (;;) {
+    journal.flush_when_idle();
+    delay(JOURNAL_POLL);
+  }
+}
+
+
+
+/**----------------------------------------------------------------------------
+  start_journal
+
+  Load the journal from its partition and start the journal task on
+  JOURNAL_TASK_CORE. Without the partition, state is kept in RAM only.
+
+  Returns:
+    bool                            true if the partition was found.
+*/
+bool start_journal() {
+  const esp_partition_t* partition = esp_partition_find_first(
+    ESP_PARTITION_TYPE_DATA, ESP_PARTITION_SUBTYPE_ANY, JOURNAL_LABEL);
+  if (!journal.begin(partition)) {
+    Serial.println("No journal partition, state is not kept");
+    return false;
+  }
+#ifdef ESP32
+  xTaskCreatePinnedToCore(journal_task, "journal", JOURNAL_TASK_STACK, NULL, 1, NULL, JOURNAL_TASK_CORE);
+#else
+  std::thread(journal_task, (void*) NULL).detach();
+#endif
+  return true;
+}
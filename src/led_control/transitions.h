@@ -0,0 +1,389 @@
+/** ===========================================================================
+  transitions.h
+
+  This file contains the transitions between animations.
+  A transition reveals the next animation pixel by pixel on top of the
+  current one. Revealed pixels are kept in a PixelMask and in the order they
+  were revealed, so composing a frame only touches revealed pixels and the
+  glow of recently revealed ones. Completion is a counter comparison.
+  The masks also tell both animations which pixels they have to render at
+  all (see Animation::render_masked()).
+
+  Transitions:
+    WipeTransition                  sweep along x
+    RadialTransition                sweep outwards from the lamp center
+    FloodTransition                 flood the lamp graph from a random vertex
+    DissolveTransition              reveal random pixels
+    CrossfadeTransition             blend all pixels at once
+
+  Sweeping transitions run backwards (right to left, inwards, towards the
+  vertex) when started with a negative direction.
+
+  Only the running transition exists. It is constructed in the scratch
+  arena when it starts (see TRANSITIONS) and released when it is done.
+*/
+
+#pragma once
+
+#include <algorithm>
+
+#include "arena.h"
+#include "pixel_mask.h"
+#include "pixels.h"
+#include "led_functions.h"
+#include "utils.h"
+
+#define TRANSITION_GLOW_FRAMES 8    // frames a revealed pixel keeps glowing
+#define TRANSITION_NOT_FULL 0xffff  // frame marker while pixels are hidden
+
+#define WIPE_SPEED 42               // x units per frame
+#define RADIAL_SPEED 22             // radius units per frame
+#define FLOOD_SPEED 2               // pixels along the graph per frame
+#define DISSOLVE_RATE 9             // pixels per frame
+#define CROSSFADE_FRAMES 40         // frames of a crossfade
+
+
+/** -----------------------------------------------------------------
+  Transition
+
+  This interface class functions as a building block for transitions.
+  Every frame, step() lets the transition reveal pixels through _reveal(),
+  then compose() writes the next animation into the revealed pixels of the
+  target and adds a white glow that fades over TRANSITION_GLOW_FRAMES.
+  The transition is done once every pixel is revealed and the glow is gone.
+*/
+class Transition
+{
+  private:
+    uint16_t _sequence[NUM_LEDs];   // revealed pixels in reveal order
+    uint16_t _starts[TRANSITION_GLOW_FRAMES];  // reveal count at the start of recent frames
+    uint16_t _full_at;              // frame all pixels were revealed in
+
+  protected:
+    PixelMask _mask;                // revealed pixels
+    PixelMask _hidden;              // pixels not revealed yet
+    int8_t _direction;              // direction given to begin()
+    uint16_t _frame;                // steps since begin()
+
+    /* reveal a pixel, revealed pixels are ignored */
+    inline void _reveal(uint16_t pixel)
+    {
+      uint16_t index = _mask.count();
+      if (_mask.set(pixel)) {
+        _sequence[index] = pixel;
+        _hidden.unset(pixel);
+      }
+    }
+
+    /* reveal the pixels of the current frame */
+    virtual void _advance() = 0;
+
+  public:
+    virtual ~Transition() {}
+
+    /**
+      begin
+
+      Start the transition with all pixels hidden.
+
+      Parameters:
+        int8_t direction            direction of the animation change: [-1, 1]
+    */
+    virtual void begin(int8_t direction)
+    {
+      _mask.clear();
+      _hidden.fill();
+      _direction = direction;
+      _frame = 0;
+      _full_at = TRANSITION_NOT_FULL;
+    }
+
+    /* advance by one frame */
+    void step()
+    {
+      _starts[_frame % TRANSITION_GLOW_FRAMES] = _mask.count();
+      _advance();
+      if (_mask.full() && _full_at == TRANSITION_NOT_FULL)
+        _full_at = _frame;
+      _frame++;
+    }
+
+    /**
+      compose
+
+      Compose the current frame of the transition.
+
+      Parameters:
+        const PixelBuffer& next     frame of the animation to transition to
+        PixelBuffer& target         frame of the current animation, modified
+    */
+    virtual void compose(const PixelBuffer& next, PixelBuffer& target)
+    {
+      _mask.for_each([&](uint16_t pixel) {
+        target.set_packed(pixel, next.get_packed(pixel));
+      });
+
+      // pixels of the last frames, newest first
+      uint8_t ages = min(_frame, (uint16_t) TRANSITION_GLOW_FRAMES);
+      for (uint8_t age = 0; age < ages; age++) {
+        uint16_t frame = _frame - 1 - age;
+        uint16_t first = _starts[frame % TRANSITION_GLOW_FRAMES];
+        uint16_t last = age == 0 ? _mask.count() : _starts[(frame + 1) % TRANSITION_GLOW_FRAMES];
+        uint8_t glow = 255 - 255 * age / TRANSITION_GLOW_FRAMES;
+        PackedColor color = packed_splat(glow);
+        for (uint16_t i = first; i < last; i++) {
+          addPixel(_sequence[i], color, target);
+        }
+      }
+    }
+
+    /* true once the transition is over */
+    virtual bool done() const
+    {
+      return _mask.full() && _frame - _full_at > TRANSITION_GLOW_FRAMES;
+    }
+
+    /* pixels the next animation has to render */
+    virtual const PixelMask& get_next_pixels() const { return _mask; }
+
+    /* pixels the current animation has to render */
+    virtual const PixelMask& get_current_pixels() const { return _hidden; }
+
+    /* getter */
+    const PixelMask& get_mask() const { return _mask; }
+};
+
+
+
+/* ========================================================================= */
+/* transitions */
+
+/** -----------------------------------------------------------------
+  SweepTransition
+
+  Reveal pixels in the order of a Projection. A front moves through the
+  keys at a constant speed, every pixel behind it is revealed. Each pixel
+  is visited once, so a frame only costs the pixels it reveals.
+*/
+class SweepTransition : public Transition
+{
+  private:
+    const Projection& _order;       // reveal order
+    uint16_t _speed;                // keys per frame
+    uint16_t _next;                 // next pixel in reveal order
+    int32_t _front;                 // distance of the front to the first key
+
+  protected:
+    void _advance() override
+    {
+      PixelSpan all = _order.all();
+      bool backwards = _direction < 0;
+      int16_t origin = backwards ? all.keys[all.count - 1] : all.keys[0];
+
+      _front += _speed;
+      while (_next < all.count) {
+        uint16_t k = backwards ? all.count - 1 - _next : _next;
+        if (abs(all.keys[k] - origin) >= _front)
+          break;
+        _reveal(all.pixels[k]);
+        _next++;
+      }
+    }
+
+  public:
+    SweepTransition(const Projection& order, uint16_t speed) :
+      _order(order),
+      _speed(speed),
+      _next(0),
+      _front(0)
+    {}
+
+    void begin(int8_t direction) override
+    {
+      Transition::begin(direction);
+      _next = 0;
+      _front = 0;
+    }
+};
+
+
+
+/** -----------------------------------------------------------------
+  WipeTransition
+
+  Bar wiping over the lamp, left to right.
+*/
+class WipeTransition : public SweepTransition
+{
+  public:
+    WipeTransition() : SweepTransition(PROJ_X, WIPE_SPEED) {}
+};
+
+
+
+/** -----------------------------------------------------------------
+  RadialTransition
+
+  Circle growing from the lamp center.
+*/
+class RadialTransition : public SweepTransition
+{
+  public:
+    RadialTransition() : SweepTransition(PROJ_RADIUS, RADIAL_SPEED) {}
+};
+
+
+
+/** -----------------------------------------------------------------
+  FloodTransition
+
+  Flood spreading along the edges of the lamp graph, starting at a random
+  vertex. Pixels are ordered by their shortest distance to that vertex
+  along the edges, which is computed once when the transition begins.
+*/
+class FloodTransition : public SweepTransition
+{
+  private:
+    Projection _distances;          // pixels sorted by graph distance
+
+  public:
+    FloodTransition() : SweepTransition(_distances, FLOOD_SPEED) {}
+
+    void begin(int8_t direction) override
+    {
+      SweepTransition::begin(direction);
+
+      // shortest distances of all vertices, in pixels
+      uint16_t dist[VERTEX_COUNT];
+      bool visited[VERTEX_COUNT];
+      for (uint8_t v = 0; v < VERTEX_COUNT; v++) {
+        dist[v] = UINT16_MAX;
+        visited[v] = false;
+      }
+      dist[RNG.below(VERTEX_COUNT)] = 0;
+
+      for (uint8_t n = 0; n < VERTEX_COUNT; n++) {
+        uint8_t v = VERTEX_COUNT;
+        for (uint8_t u = 0; u < VERTEX_COUNT; u++) {
+          if (!visited[u] && (v == VERTEX_COUNT || dist[u] < dist[v]))
+            v = u;
+        }
+        visited[v] = true;
+        for (uint8_t k = TOPOLOGY.vertex_offsets[v]; k < TOPOLOGY.vertex_offsets[v + 1]; k++) {
+          uint8_t e = TOPOLOGY.vertex_edges[k];
+          uint8_t u = edge_vertex(e, !TOPOLOGY.vertex_edge_starts[k]);
+          dist[u] = min(dist[u], (uint16_t) (dist[v] + E[e].get_length() + 1));
+        }
+      }
+
+      // pixels are reached through the closer end of their edge
+      _distances.build_by([&dist](uint16_t pixel) {
+        uint8_t e = pixel_edge(pixel);
+        uint8_t offset = pixel_edge_offset(pixel);
+        return min(dist[edge_vertex(e, EDGE_START)] + offset,
+                   dist[edge_vertex(e, EDGE_END)] + E[e].get_length() - offset);
+      });
+    }
+};
+
+
+
+/** -----------------------------------------------------------------
+  DissolveTransition
+
+  Reveal DISSOLVE_RATE random pixels per frame. Hidden pixels are kept in a
+  pool, so every pick hits a hidden pixel.
+*/
+class DissolveTransition : public Transition
+{
+  private:
+    uint16_t _pool[NUM_LEDs];       // hidden pixels, the first _remaining are valid
+    uint16_t _remaining;            // amount of hidden pixels
+
+  protected:
+    void _advance() override
+    {
+      for (uint8_t n = 0; n < DISSOLVE_RATE && _remaining > 0; n++) {
+        uint16_t k = RNG.below(_remaining);
+        _reveal(_pool[k]);
+        _pool[k] = _pool[--_remaining];
+      }
+    }
+
+  public:
+    void begin(int8_t direction) override
+    {
+      Transition::begin(direction);
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        _pool[i] = i;
+      }
+      _remaining = NUM_LEDs;
+    }
+};
+
+
+
+/** -----------------------------------------------------------------
+  CrossfadeTransition
+
+  Blend all pixels from the current to the next animation over
+  CROSSFADE_FRAMES frames. There is no glow and both animations render every
+  pixel.
+*/
+class CrossfadeTransition : public Transition
+{
+  private:
+    PixelMask _all;                 // every pixel
+
+  protected:
+    void _advance() override {}
+
+  public:
+    CrossfadeTransition() { _all.fill(); }
+
+    const PixelMask& get_next_pixels() const override { return _all; }
+    const PixelMask& get_current_pixels() const override { return _all; }
+
+    void compose(const PixelBuffer& next, PixelBuffer& target) override
+    {
+      uint8_t t = min(_frame * 255 / CROSSFADE_FRAMES, 255);
+      for (uint16_t i = 0; i < NUM_LEDs; i++) {
+        target.set_packed(i, packed_lerp(target.get_packed(i), next.get_packed(i), t));
+      }
+    }
+
+    bool done() const override
+    {
+      return _frame >= CROSSFADE_FRAMES;
+    }
+};
+
+
+
+/* ========================================================================= */
+/* transition constructors */
+
+/* construct a transition in an arena, NULL if it does not fit */
+template<class TRANSITION>
+Transition* create_transition(Arena& arena) {
+  return arena.create<TRANSITION>();
+}
+
+Transition* (* const TRANSITIONS[])(Arena&) = {
+  &create_transition<WipeTransition>,
+  &create_transition<RadialTransition>,
+  &create_transition<FloodTransition>,
+  &create_transition<DissolveTransition>,
+  &create_transition<CrossfadeTransition>
+};
+
+#define TRANSITION_COUNT ARRAY_SIZE(TRANSITIONS)
+
+/* scratch memory of a transition: the largest one and the next frame */
+constexpr size_t TRANSITION_SCRATCH = std::max({
+  sizeof(WipeTransition),
+  sizeof(RadialTransition),
+  sizeof(FloodTransition),
+  sizeof(DissolveTransition),
+  sizeof(CrossfadeTransition)
+}) + sizeof(PixelBuffer) + 2 * ARENA_ALIGN;
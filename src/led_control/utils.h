@@ -7,15 +7,22 @@
 */
 
 #pragma once
+#include "pixel_buffer.h"
 #include "led_functions.h"
+#include "input_sampler.h"
+#include "rng.h"
 
 extern float MAX_MILLIAMPS;
-extern NeoPixelBus<NeoGrbwFeature, NeoSk6812Method> strip;
+extern PixelBuffer framebuffer;
 
 /* external input variables */
-extern const float INPUT_SMOOTHING;
 extern float BRIGHTNESS, MOD;
 extern bool LEFT_BUTTON, RIGHT_BUTTON;
+extern uint8_t BUTTON_CLICKS;
+
+/* button click flags */
+#define LEFT_CLICK  0x04            // left button went down
+#define RIGHT_CLICK 0x08            // right button went down
 
 #define ARRAY_SIZE(arr) (uint16_t) (*(&arr + 1) - arr)
 
@@ -45,33 +52,18 @@ inline uint8_t maxColorVal(RgbwColor color) {
 /**----------------------------------------------------------------------------
   buffer_empty
 
-  Determine whether the given buffer is empty. If no buffer is given, the led
-  strip is assumed.
+  Determine whether the given buffer is empty. If no buffer is given, the
+  framebuffer is assumed.
 
   Parameters:
-    RgbwColor* buffer (optional)    buffer of size NUM_LEDs.
+    PixelBuffer& buffer (optional)  buffer to check.
 
   Returns:
     true                      if all colors are black,
     false                     otherwise.
 */
-bool buffer_empty(RgbwColor* buffer) {
-  for (int i = 0; i < NUM_LEDs; i++) {
-    if (buffer[i].R != 0 || buffer[i].G != 0 || 
-        buffer[i].B != 0 || buffer[i].W != 0)
-      return false;
-  }
-  return true;
-}
-
-bool buffer_empty() {
-  for (int i = 0; i < NUM_LEDs; i++) {
-    RgbwColor col = strip.GetPixelColor(i);
-    if (col.R != 0 || col.G != 0 || 
-        col.B != 0 || col.W != 0)
-      return false;
-  }
-  return true;
+inline bool buffer_empty(const PixelBuffer& buffer = framebuffer) {
+  return buffer.channel_sum() == 0;
 }
 
 
@@ -80,48 +72,18 @@ bool buffer_empty() {
   calculateMilliAmps
 
   Calculate the milliamps used to display a given buffer. If no buffer is
-  given, the current led strip is assumed.
-
-  NOTE: maxes out at about 65A. Just keep that in mind.
+  given, the framebuffer is assumed. Buffers track their channel sum on every
+  write, so this does not need to scan any pixels.
 
   Parameters:
-    RgbwColor* buffer (optional)    buffer of size NUM_LEDs
+    PixelBuffer& buffer (optional)  buffer to check.
 
   Returns:
-    int                         current drawn in milliamps.
+    uint32_t                        current drawn in milliamps.
 */
-uint16_t calculate_milliamps(RgbwColor* buffer) {
-  uint16_t total = 0;
-  float temp;
-  for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    // accumulate in float for that extra precision
-    temp = 0;
-    // max. 20 mAh per led
-    temp += (buffer[i].R * 20) / 255.0;
-    temp += (buffer[i].G * 20) / 255.0;
-    temp += (buffer[i].B * 20) / 255.0;
-    temp += (buffer[i].W * 20) / 255.0;
-    total += temp;
-  }
-  return total;
-}
-
-uint16_t calculate_milliamps() {
-  uint16_t total = 0;
-  float temp;
-  RgbwColor col;
-  for (uint16_t i = 0; i < NUM_LEDs; i++) {
-    // accumulate in float for that extra precision
-    temp = 0;
-    col = strip.GetPixelColor(i);
-    // max. 20 mAh per led
-    temp += (col.R * 20) / 255.0;
-    temp += (col.G * 20) / 255.0;
-    temp += (col.B * 20) / 255.0;
-    temp += (col.W * 20) / 255.0;
-    total += temp;
-  }
-  return total;
+inline uint32_t calculate_milliamps(const PixelBuffer& buffer = framebuffer) {
+  // max. 20 mA per channel at full brightness
+  return buffer.channel_sum() * 20 / 255;
 }
 
 
@@ -151,9 +113,50 @@ void setMaxMilliamps(float val) {
 // other led functions
 
 /**----------------------------------------------------------------------------
-  Hsvw2Rgbw
+  HsvColor
+
+  Fixed-point HSV color as used by the integer conversion kernels.
+
+  Members:
+    uint16_t H: [0,HUE_STEPS)       hue, HUE_STEPS / 6 steps per sector.
+    uint8_t S: [0,255]              saturation.
+    uint8_t V: [0,255]              value.
+*/
+#define HUE_STEPS 1536
 
-  Convert HSVW color to RBGW color.
+struct HsvColor {
+  uint16_t H;
+  uint8_t S, V;
+};
+
+
+
+/**----------------------------------------------------------------------------
+  hue_to_fixed, unit_to_u8
+
+  Convert float hue and [0,1] values to the fixed-point HsvColor ranges.
+  Out of range values are clamped, a hue of 360 wraps around to 0.
+*/
+inline uint16_t hue_to_fixed(float H) {
+  if (!(H > 0))
+    return 0;
+  uint32_t h = H * (HUE_STEPS / 360.0f);
+  return h >= HUE_STEPS ? (H >= 360 ? 0 : HUE_STEPS - 1) : h;
+}
+
+inline uint8_t unit_to_u8(float value) {
+  if (!(value > 0))
+    return 0;
+  return value >= 1 ? 255 : (uint8_t) (value * 255);
+}
+
+
+
+/**----------------------------------------------------------------------------
+  Hsvw2Rgbw_reference
+
+  Convert HSVW color to RBGW color in floating point. This is the original
+  conversion and is kept as reference for the fixed-point kernel.
 
   Source: https://www.codespeedy.com/hsv-to-rgb-in-cpp/
 
@@ -167,7 +170,7 @@ void setMaxMilliamps(float val) {
     RgbwColor                       black     , if invalid inputs
                                     rgb color , else
 */
-RgbwColor Hsvw2Rgbw(float H, float S, float V, float W) {
+RgbwColor Hsvw2Rgbw_reference(float H, float S, float V, float W) {
 
   H = constrain(H, 0, 360);
   S = constrain(S, 0, 1);
@@ -204,17 +207,111 @@ RgbwColor Hsvw2Rgbw(float H, float S, float V, float W) {
 }
 
 
+
+/**----------------------------------------------------------------------------
+  Hsvw2Rgbw
+
+  Convert HSVW color to RBGW color using integer arithmetic only.
+  Every hue sector has a fixed order of the max, mid and min channel, so the
+  six-way branch of the reference is replaced by a lookup.
+  Results are within 1 of Hsvw2Rgbw_reference.
+
+  Parameters:
+    uint16_t H: [0,HUE_STEPS)       hue.
+    uint8_t S: [0,255]              saturation.
+    uint8_t V: [0,255]              value.
+    uint8_t W: [0,255]              white component.
+
+  Returns:
+    RgbwColor                       rgbw color
+*/
+
+// floor(x / 255) for x < 65535
+#define DIV255(x) (((x) + 1 + ((x) >> 8)) >> 8)
+
+inline RgbwColor Hsvw2Rgbw(uint16_t H, uint8_t S, uint8_t V, uint8_t W) {
+  // channel order per sector, indices into {max, mid, min}
+  static const uint8_t order[6][3] = {
+    {0, 1, 2}, {1, 0, 2}, {2, 0, 1}, {2, 1, 0}, {1, 2, 0}, {0, 2, 1}
+  };
+
+  uint8_t sector = H >> 8;
+  uint16_t frac = H & 0xff;
+  // odd sectors fall instead of rise
+  if (sector & 1)
+    frac = 256 - frac;
+
+  uint16_t c = V * S;                     // chroma * 255
+  uint16_t m = V * 255 - c;               // minimum * 255
+  uint16_t x = (c * (uint32_t) frac) >> 8;
+
+  uint8_t ch[3] = {
+    V,
+    (uint8_t) DIV255(m + x),
+    (uint8_t) DIV255(m)
+  };
+  const uint8_t* o = order[sector];
+  return RgbwColor(ch[o[0]], ch[o[1]], ch[o[2]], W);
+}
+
+RgbwColor Hsvw2Rgbw(float H, float S, float V, float W) {
+  return Hsvw2Rgbw(hue_to_fixed(H), unit_to_u8(S), unit_to_u8(V), unit_to_u8(W));
+}
+
+
+
+/**----------------------------------------------------------------------------
+  Hsvw2Rgbw (batch)
+
+  Convert an array of fixed-point HSV colors in one pass.
+
+  Parameters:
+    const HsvColor* hsv             colors to convert.
+    RgbwColor* out                  output buffer, same size as hsv.
+    uint16_t count                  amount of colors.
+    uint8_t W (optional)            white component for all colors.
+*/
+void Hsvw2Rgbw(const HsvColor* hsv, RgbwColor* out, uint16_t count, uint8_t W = 0) {
+  for (uint16_t i = 0; i < count; i++) {
+    out[i] = Hsvw2Rgbw(hsv[i].H, hsv[i].S, hsv[i].V, W);
+  }
+}
+
+
+/**----------------------------------------------------------------------------
+  lerp8
+
+  Linear interpolation between two channel values in fixed point, rounded
+  to the nearest value. Both ends are exact, equal values stay unchanged.
+
+  Parameters:
+    uint8_t a                       value at t = 0.
+    uint8_t b                       value at t = 65535.
+    uint16_t t: [0,65535]           interpolation factor.
+
+  Returns:
+    uint8_t                         interpolated value.
+*/
+inline uint8_t lerp8(uint8_t a, uint8_t b, uint16_t t) {
+  return ((uint32_t) a * (65535 - t) + (uint32_t) b * t + 32767) >> 16;
+}
+
+
+
 /**----------------------------------------------------------------------------
   random_hsvw_color
 
   Return a random HSVW color. W component not considered.
   S and V are set to 1.
 
+  Parameters:
+    Rng& rng                        generator to draw the hue from
+
   Returns:
     RgbwColor                       random color.
 */
-inline RgbwColor random_hsvw_color() {
-  return Hsvw2Rgbw((float) random(360), 1, 1, 0);
+inline RgbwColor random_hsvw_color(Rng& rng) {
+  return Hsvw2Rgbw((float) rng.below(360), 1, 1, 0);
 }
 
 
@@ -225,23 +322,42 @@ inline RgbwColor random_hsvw_color() {
 /**----------------------------------------------------------------------------
   update_inputs
 
-  Update all inputs.
+  Update all inputs. The potis are not read here, their filtered values are
+  taken from the latest snapshot of the input sampler (see input_sampler.h).
 
   Sets:
-    BRIGHTNESS                      interpolated brightness:  [0,1]
-    MOD                             interpolated mod:         [0,1]
+    BRIGHTNESS                      filtered brightness:  [0,1],
+                                    linear, the output stage applies gamma
+    MOD                             filtered mod:         [0,1]
     LEFT_BUTTON                     true if left  button is pressed
     RIGHT_BUTTON                    true if right button is pressed
+    BUTTON_CLICKS                   LEFT_CLICK and RIGHT_CLICK if the
+                                    button went from high to low
 */
-// TODO: implement non-linear brightness calculation
 void update_inputs() {
-  // button inputs
-  LEFT_BUTTON  = LOW; // digitalRead(BTN_L_PIN);
-  RIGHT_BUTTON = digitalRead(BTN_R_PIN);
+  static bool last_left  = digitalRead(BTN_L_PIN) == HIGH;
+  static bool last_right = digitalRead(BTN_R_PIN) == HIGH;
+
+  // button inputs, pulled up, so pressed buttons read low
+  bool left  = digitalRead(BTN_L_PIN) == HIGH;
+  bool right = digitalRead(BTN_R_PIN) == HIGH;
+  LEFT_BUTTON  = !left;
+  RIGHT_BUTTON = !right;
+  BUTTON_CLICKS = (last_left && !left ? LEFT_CLICK : 0) |
+                  (last_right && !right ? RIGHT_CLICK : 0);
+  last_left  = left;
+  last_right = right;
+
+#ifndef ESP32
+  // no sampling task on a host, take the samples of one frame
+  for (uint8_t n = 0; n < FRAME_DELAY / INPUT_SAMPLE_PERIOD; n++) {
+    input_sampler.sample();
+  }
+#endif
 
   // poti inputs
-  float reading_brightness = (analogRead(POTI_B_PIN)/4096.0);
-  float reading_mod = (analogRead(POTI_M_PIN)/4096.0);
-  BRIGHTNESS  = INPUT_SMOOTHING * BRIGHTNESS  + (1 - INPUT_SMOOTHING) * reading_brightness;
-  MOD         = INPUT_SMOOTHING * MOD         + (1 - INPUT_SMOOTHING) * reading_mod;
+  InputSnapshot inputs = input_sampler.snapshot();
+  BRIGHTNESS  = inputs.brightness;
+  MOD         = inputs.mod;
 }
+